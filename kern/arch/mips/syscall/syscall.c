@@ -36,6 +36,8 @@
 #include <current.h>
 #include <syscall.h>
 #include <addrspace.h>
+#include <endian.h>
+#include <copyinout.h>
 
 // assignments
 #include "opt-asst1.h"
@@ -89,6 +91,12 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+#if OPT_ASST1
+	uint64_t pos64;
+	off_t retval64;
+	uint32_t hi, lo;
+	int whence;
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -117,17 +125,69 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_sched_setaffinity:
+		err = sys_sched_setaffinity(tf->tf_a0);
+		break;
+
+	    case SYS_sched_getaffinity:
+		err = sys_sched_getaffinity((userptr_t)tf->tf_a0);
+		break;
+
+	    case SYS_futex_wait:
+		err = sys_futex_wait((userptr_t)tf->tf_a0, tf->tf_a1);
+		break;
+
+	    case SYS_futex_wake:
+		err = sys_futex_wake((userptr_t)tf->tf_a0, tf->tf_a1,
+				     &retval);
+		break;
+
 	    /* Add stuff here */
 
 #if OPT_ASST1
 		case SYS_write:
-		err = sys_write((int)tf->tf_a0, (const void*)tf->tf_a1, 
-				(size_t) tf->tf_a2);
+		err = sys_write((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+				(size_t) tf->tf_a2, &retval);
 		break;
 
 		case SYS_read:
-		err = sys_read((int)tf->tf_a0, (void*)tf->tf_a1, 
-				(size_t) tf->tf_a2);
+		err = sys_read((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+				(size_t) tf->tf_a2, &retval);
+		break;
+
+		case SYS_open:
+		err = sys_open((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+				(mode_t)tf->tf_a2, &retval);
+		break;
+
+		case SYS_close:
+		err = sys_close((int)tf->tf_a0);
+		break;
+
+		case SYS_lseek:
+		/*
+		 * The 64-bit offset is in the aligned register pair
+		 * a2/a3, so whence goes on the stack, and the 64-bit
+		 * result comes back in v0/v1.
+		 */
+		join32to64(tf->tf_a2, tf->tf_a3, &pos64);
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &whence,
+				sizeof(whence));
+		if (err) {
+			break;
+		}
+		err = sys_lseek((int)tf->tf_a0, pos64, whence, &retval64);
+		if (err) {
+			break;
+		}
+		split64to32(retval64, &hi, &lo);
+		retval = hi;
+		tf->tf_v1 = lo;
 		break;
 
 		case SYS__exit:
@@ -137,9 +197,8 @@ syscall(struct trapframe *tf)
 
 #if OPT_WAIT_PID
 		case SYS_waitpid:
-		retval = sys_waitpid((pid_t)tf->tf_a0, (int*)tf->tf_a1,
-					(int)tf->tf_a2);
-		err = (retval < 0) ? ENOSYS : 0;
+		err = sys_waitpid((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+					(int)tf->tf_a2, &retval);
 		break;
 
 		case SYS_fork:
@@ -342,3 +342,120 @@ mainbus_interrupt(struct trapframe *tf)
 		}
 	}
 }
+
+/*
+ * Tickless idle support.
+ *
+ * The on-chip timer's count register goes back to zero when it
+ * reaches the compare register, so c0_compare is the time from one
+ * timer interrupt to the next. Setting it to several ticks' worth
+ * lets an idle cpu sleep through them.
+ */
+
+#define TICK_CYCLES (CPU_FREQUENCY / HZ)
+
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+static
+bool
+mips_timer_pending(void)
+{
+	uint32_t cause;
+
+	/* $13 == c0_cause */
+	__asm volatile("mfc0 %0, $13" : "=r" (cause));
+	return (cause & MIPS_TIMER_BIT) != 0;
+}
+
+/*
+ * Make the next timer interrupt on this cpu come TICKS ticks after
+ * the last one instead of one tick after. Fails if the next one is
+ * already pending. Interrupts must be off.
+ */
+bool
+mainbus_timer_stretch(unsigned ticks)
+{
+	KASSERT(ticks > 0 && ticks <= 0xffffffff / TICK_CYCLES);
+	KASSERT(curthread->t_curspl > 0);
+
+	if (mips_timer_pending()) {
+		return false;
+	}
+	mips_timer_set(ticks * TICK_CYCLES);
+	return true;
+}
+
+/*
+ * Go back to one tick per timer interrupt after mainbus_timer_stretch
+ * (TICKS being the value passed to it). Returns the number of ticks
+ * that have gone by since the last timer interrupt was taken; the
+ * next one is due at the following tick. Interrupts must be off.
+ */
+unsigned
+mainbus_timer_resume(unsigned ticks)
+{
+	uint32_t count;
+	unsigned elapsed;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	if (mips_timer_pending()) {
+		/* The whole stretch ran out; this clears the interrupt. */
+		mips_timer_set(TICK_CYCLES);
+		return ticks;
+	}
+
+	count = mips_timer_get();
+	elapsed = count / TICK_CYCLES;
+
+	/*
+	 * If the next tick boundary is very close, count it now and
+	 * aim for the one after, so count can't get past compare
+	 * before we've set it. (It wouldn't match again for minutes.)
+	 */
+	if ((elapsed + 1) * TICK_CYCLES - count < TICK_CYCLES / 8) {
+		elapsed++;
+	}
+	mips_timer_set((elapsed + 1) * TICK_CYCLES);
+	return elapsed;
+}
+
+/*
+ * Cycles since this cpu started taking hardclocks: the ticks it has
+ * counted plus how far into the current one we are. While the timer
+ * is stretched the count just keeps going past a tick's worth, so
+ * that works too. If the timer has expired but the interrupt hasn't
+ * been taken yet, the count has started over, so add the ticks that
+ * hardclock() will be counting.
+ */
+uint64_t
+mainbus_cycles(void)
+{
+	uint64_t ticks;
+	uint32_t count;
+	int spl;
+
+	spl = splhigh();
+	ticks = curcpu->c_hardclocks;
+	count = mips_timer_get();
+	if (mips_timer_pending()) {
+		ticks += curcpu->c_tickless > 0 ? curcpu->c_tickless : 1;
+	}
+	splx(spl);
+
+	return ticks * TICK_CYCLES + count;
+}
@@ -134,21 +134,46 @@ putch_intr(struct con_softc *cs, int ch)
 }
 
 /*
- * Read a character, using interrupts to wait for I/O completion.
+ * Take a character out of the input buffer, once the read semaphore
+ * says there is one.
  */
 static
 int
-getch_intr(struct con_softc *cs)
+getch_dequeue(struct con_softc *cs)
 {
 	unsigned char ret;
 
-	P(cs->cs_rsem);
 	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
 	cs->cs_gotchars_tail =
 		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
 	return ret;
 }
 
+/*
+ * Read a character, using interrupts to wait for I/O completion.
+ */
+static
+int
+getch_intr(struct con_softc *cs)
+{
+	P(cs->cs_rsem);
+	return getch_dequeue(cs);
+}
+
+/*
+ * Read a character if one has already arrived; otherwise return -1
+ * without waiting.
+ */
+static
+int
+getch_intr_nowait(struct con_softc *cs)
+{
+	if (sem_timedP(cs->cs_rsem, 0)) {
+		return -1;
+	}
+	return getch_dequeue(cs);
+}
+
 /*
  * Called from underlying device when a read-ready interrupt occurs.
  *
@@ -240,12 +265,95 @@ con_eachopen(struct device *dev, int openflags)
 	return 0;
 }
 
+/*
+ * User I/O moves data to and from the uio a chunk at a time rather
+ * than with a uiomove (and so a copyin or copyout) per character.
+ */
+#define CON_IOCHUNK 128
+
+/*
+ * Read. Wait for the first character, then take whatever else has
+ * already come in, stopping at the end of a line; don't wait for
+ * more just to fill the buffer.
+ */
+static
+int
+con_read(struct con_softc *cs, struct uio *uio)
+{
+	char buf[CON_IOCHUNK];
+	size_t len;
+	bool first;
+	int ch, result;
+
+	len = 0;
+	first = true;
+	while (uio->uio_resid > len) {
+		if (first) {
+			ch = getch_intr(cs);
+			first = false;
+		}
+		else {
+			ch = getch_intr_nowait(cs);
+			if (ch < 0) {
+				break;
+			}
+		}
+		if (ch=='\r') {
+			ch = '\n';
+		}
+		buf[len++] = ch;
+		if (ch=='\n') {
+			break;
+		}
+		if (len == sizeof(buf)) {
+			result = uiomove(buf, len, uio);
+			if (result) {
+				return result;
+			}
+			len = 0;
+		}
+	}
+	if (len > 0) {
+		return uiomove(buf, len, uio);
+	}
+	return 0;
+}
+
+/*
+ * Write.
+ */
+static
+int
+con_write(struct uio *uio)
+{
+	char buf[CON_IOCHUNK];
+	size_t len, i;
+	int result;
+
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > sizeof(buf)) {
+			len = sizeof(buf);
+		}
+		result = uiomove(buf, len, uio);
+		if (result) {
+			return result;
+		}
+		for (i=0; i<len; i++) {
+			if (buf[i]=='\n') {
+				putch('\r');
+			}
+			putch(buf[i]);
+		}
+	}
+	return 0;
+}
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
 	int result;
-	char ch;
 	struct lock *lk;
 
 	(void)dev;  // unused
@@ -260,35 +368,15 @@ con_io(struct device *dev, struct uio *uio)
 	KASSERT(lk != NULL);
 	lock_acquire(lk);
 
-	while (uio->uio_resid > 0) {
-		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
-			if (ch=='\r') {
-				ch = '\n';
-			}
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				break;
-			}
-		}
-		else {
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
-		}
+	if (uio->uio_rw==UIO_READ) {
+		result = con_read(the_console, uio);
+	}
+	else {
+		result = con_write(uio);
 	}
+
 	lock_release(lk);
-	return 0;
+	return result;
 }
 
 static
@@ -35,6 +35,9 @@
  */
 
 #include <kern/time.h>
+#include <spinlock.h>
+
+struct cpu;
 
 
 /*
@@ -48,6 +51,15 @@
 void hardclock_bootstrap(void);
 void hardclock(void);
 
+/*
+ * Tickless idle. The idle loop calls hardclock_idle() just before
+ * idling the cpu, with interrupts off, to stop hardclocks until the
+ * next timer is due, and hardclock_unidle() right after, to catch up
+ * on the ticks that were skipped.
+ */
+void hardclock_idle(void);
+void hardclock_unidle(void);
+
 /*
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
@@ -76,8 +88,58 @@ void timespec_sub(const struct timespec *t1,
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ *
+ * ticksleep() suspends execution for at least the requested number
+ * of hardclocks.
  */
 void clocksleep(int seconds);
+void ticksleep(unsigned ticks);
+
+/*
+ * Timers.
+ *
+ * A timer calls a function from hardclock() once a given number of
+ * hardclock ticks have passed. The function is called in interrupt
+ * context on the cpu the timer was started on, with no locks held.
+ *
+ * timer_init prepares a timer (allocated by the caller, often on the
+ * stack) to call FUNC(DATA).
+ *
+ * timer_start arms it to go off TICKS hardclocks from now (or at the
+ * next hardclock, if TICKS is 0). It must not already be pending.
+ *
+ * timer_stop disarms it, and returns true if it was still pending.
+ * If the function is running on another cpu, it waits for it to
+ * finish, so the timer may be freed afterwards. Therefore it must
+ * not be called while holding any lock the function takes.
+ */
+struct timer {
+	struct timer *tm_next;		/* Next timer in wheel slot */
+	struct timer **tm_pprev;	/* Pointer to us, if pending */
+	struct cpu *tm_cpu;		/* Cpu it was last started on */
+	unsigned tm_expires;		/* Hardclock count to go off at */
+	void (*tm_func)(void *);	/* Function to call */
+	void *tm_data;			/* Argument for tm_func */
+};
+
+void timer_init(struct timer *tm, void (*func)(void *), void *data);
+void timer_start(struct timer *tm, unsigned ticks);
+bool timer_stop(struct timer *tm);
+
+/*
+ * Per-cpu timer wheel. This is a hash table of the pending timers
+ * keyed by expiry time modulo TIMERWHEEL_SLOTS; each hardclock looks
+ * at one slot and runs the timers in it that are due.
+ */
+#define TIMERWHEEL_SLOTS 128
+
+struct timerwheel {
+	struct spinlock tw_lock;
+	struct timer *tw_slots[TIMERWHEEL_SLOTS];
+	struct timer *volatile tw_running; /* Timer whose function is running */
+};
+
+void timerwheel_init(struct timerwheel *tw);
 
 
 #endif /* _CLOCK_H_ */
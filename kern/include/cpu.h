@@ -32,6 +32,7 @@
 
 
 #include <spinlock.h>
+#include <clock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
@@ -53,23 +54,36 @@ struct cpu {
 	struct cpu *c_self;		/* Canonical address of this struct */
 	unsigned c_number;		/* This cpu's cpu number */
 	unsigned c_hardware_number;	/* Hardware-defined cpu number */
+	struct thread *c_idlethread;	/* Runs when nothing else can */
 
 	/*
 	 * Accessed only by this cpu.
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Dead threads kept for reuse */
+	struct thread *c_migrant;	/* Thread switching out to move */
+	struct workqueue *c_workqueue;	/* Deferred work for this cpu */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_tickless;		/* Ticks the timer is stretched over */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct lockstat_table *c_lockstat; /* Lock statistics, if enabled */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
+	unsigned c_rcu_epoch;		/* RCU epoch at last switch (no lock) */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus.
+	 * Protected by its own lock.
+	 */
+	struct timerwheel c_timers;	/* Timers running on this cpu */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -102,12 +116,16 @@ struct cpu {
  *
  * cpu_create calls cpu_machdep_init.
  *
+ * cpu_lookup returns the cpu with the given software number (c_number),
+ * or NULL if there isn't one.
+ *
  * cpu_start_secondary is the platform-dependent assembly language
  * entry point for new CPUs; it can be found in start.S. It calls
  * cpu_hatch after having claimed the startup stack and thread created
  * for the cpu.
  */
 struct cpu *cpu_create(unsigned hardware_number);
+struct cpu *cpu_lookup(unsigned software_number);
 void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
@@ -197,6 +197,14 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Scheduling --
+#define SYS_sched_setaffinity 121
+#define SYS_sched_getaffinity 122
+
+//                              -- Synchronization --
+#define SYS_futex_wait   123
+#define SYS_futex_wake   124
+
 /*CALLEND*/
 
 
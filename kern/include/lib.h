@@ -125,6 +125,11 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ *
+ * kheap_profile_* control allocation-site sampling, which is always
+ * compiled in: start samples one allocation in RATE, stop turns
+ * sampling off, reset discards what was collected, and dump prints
+ * bytes and counts by call site and size class.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
@@ -132,6 +137,10 @@ void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+void kheap_profile_start(unsigned rate);
+void kheap_profile_stop(void);
+void kheap_profile_reset(void);
+void kheap_profile_dump(void);
 
 /*
  * C string functions.
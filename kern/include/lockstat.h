@@ -0,0 +1,45 @@
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics ("options lockstat").
+ *
+ * Every acquire and release of a spinlock or a sleep lock is charged
+ * to an entry: sleep locks by name, so all the locks called
+ * "proc_lock" say add up together, and spinlocks (which have no
+ * names) by the address of the code that acquired them. Each cpu
+ * keeps its own table, updated with interrupts off, so recording
+ * never needs a lock of its own.
+ *
+ * Times are in cycles, as measured by mainbus_cycles(). A thread can
+ * move to another cpu while waiting for or holding a sleep lock,
+ * which makes those times a little rough.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+struct lockstat_table;
+
+/* Make a table for a new cpu. May return NULL (no stats then). */
+struct lockstat_table *lockstat_create(void);
+
+/*
+ * Record an acquire: NAME for sleep locks, or SITE for spinlocks;
+ * whether it had to wait, how many times it polled the lock while
+ * waiting, and for how long.
+ */
+void lockstat_acquired(const char *name, vaddr_t site, bool contended,
+		       unsigned spins, uint64_t waitcycles);
+
+/* Record a release, after holding the lock for HOLDCYCLES. */
+void lockstat_released(const char *name, vaddr_t site, uint64_t holdcycles);
+
+/* Print the totals, hottest first, or start over. */
+void lockstat_dump(void);
+void lockstat_reset(void);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
@@ -58,6 +58,22 @@ void mainbus_send_ipi(struct cpu *target);
 /* Request breaking into the debugger, where available. */
 void mainbus_debugger(void);
 
+/*
+ * Stretch the current cpu's hardclock timer so the next interrupt
+ * comes TICKS ticks after the last one, for idling; and put it back,
+ * returning the number of ticks that went by since the last timer
+ * interrupt.
+ */
+bool mainbus_timer_stretch(unsigned ticks);
+unsigned mainbus_timer_resume(unsigned ticks);
+
+/*
+ * Cycle counter for timing short events on the current cpu. Counts
+ * from when the cpu started taking hardclocks, so readings from
+ * different cpus aren't comparable.
+ */
+uint64_t mainbus_cycles(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
@@ -0,0 +1,58 @@
+#ifndef _OPENFILE_H_
+#define _OPENFILE_H_
+
+/*
+ * Open files and per-process file descriptor tables.
+ *
+ * A file descriptor refers to an openfile: a vnode together with the
+ * seek position and the flags it was opened with. Descriptors copied
+ * by fork share the openfile, so it's reference counted, and the
+ * offset has a sleep lock that's held across the whole I/O so that
+ * processes sharing it don't interleave their updates.
+ */
+
+#include <spinlock.h>
+
+struct vnode;
+struct lock;
+struct proc;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_flags;			/* flags given to open */
+	struct lock *of_offsetlock;	/* protects of_offset */
+	off_t of_offset;
+	struct spinlock of_reflock;	/* protects of_refcount */
+	unsigned of_refcount;
+};
+
+/* Open PATH, as for vfs_open. PATH may be destroyed. */
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+
+/* Add or drop a reference; the last one closes the file. */
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+/*
+ * Descriptor table operations. The table lives in struct proc and is
+ * protected by p_lock.
+ *
+ * filetable_place puts OF in the lowest free descriptor, taking over
+ * the caller's reference. filetable_get returns a new reference,
+ * which the caller must drop. filetable_remove drops the table's
+ * reference.
+ */
+int filetable_place(struct proc *p, struct openfile *of, int *fd);
+int filetable_get(struct proc *p, int fd, struct openfile **ret);
+int filetable_remove(struct proc *p, int fd);
+
+/* Share all of FROM's open files with TO, which has none. */
+void filetable_copy(struct proc *from, struct proc *to);
+
+/* Close everything. */
+void filetable_closeall(struct proc *p);
+
+/* Open the console as stdin, stdout and stderr. */
+int filetable_openconsole(struct proc *p);
+
+#endif /* _OPENFILE_H_ */
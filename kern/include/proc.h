@@ -36,12 +36,16 @@
  * Note: curproc is defined by <current.h>.
  */
 
+#include <limits.h>
 #include <spinlock.h>
 #include <synch.h>
+#include <rcu.h>
 
 #include "opt-wait_pid.h"
+#include "opt-asst1.h"
 
 struct addrspace;
+struct openfile;
 struct thread;
 struct vnode;
 
@@ -72,18 +76,35 @@ struct proc {
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
+#if OPT_ASST1
+	struct openfile *p_fds[OPEN_MAX];	/* file descriptors (openfile.h) */
+#endif
+
+	/* for freeing after lockless lookups are done with it */
+	struct rcu_head p_rcu;
 
 	/* add more material here as needed */
 
 #if OPT_WAIT_PID
 	pid_t pid;
 
-	/* conditional variable used to wait for process termination */
-	struct lock *p_exit_cv_lock;
-	struct cv *p_exit_cv;
-
-	/* exit code of the process */
-	int p_exit_code;
+	/*
+	 * Family. p_parent is NULL once the parent has exited, and
+	 * then nobody will wait for us: we clean up after ourselves.
+	 * All three are protected by the global exit lock in proc.c.
+	 */
+	struct proc *p_parent;
+	struct proc *p_children;	/* first child */
+	struct proc *p_sibling;		/* next child of the same parent */
+
+	/*
+	 * Exit status. Once p_zombie is set all that's left of the
+	 * process is this structure, waiting to be reaped. The exit
+	 * code is a single word, so proc_exited can read it without
+	 * taking the exit lock.
+	 */
+	bool p_zombie;
+	volatile int p_exit_code;
 #endif
 };
 
@@ -111,9 +132,28 @@ struct addrspace *proc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *proc_setas(struct addrspace *);
 
-/* Wait for process termination */
-int proc_wait (struct proc *p);
+/*
+ * Wait for the child with pid PID to exit and reap it. With WNOHANG
+ * in FLAGS, return 0 instead of waiting if it's still running.
+ */
+pid_t proc_wait (pid_t pid, int flags, int *exit_code);
+
+/* Check without locking whether a process has exited, and how */
+bool proc_exited(struct proc *p, int *exit_code);
 
+/*
+ * Exit: release everything but the proc structure, then leave it as
+ * a zombie for the parent or, if there isn't one, destroy it. The
+ * exiting thread must already have been removed from it.
+ */
+void proc_exit(struct proc *p, int exit_code);
+
+/*
+ * Look up a process by pid, without locking. The caller must hold
+ * rcu_read_lock across the call and while it uses the result; once it
+ * unlocks, the process may be freed, unless the caller keeps it alive
+ * some other way (as its parent does until it waits for it).
+ */
 struct proc *proc_get(pid_t pid);
 
 /**
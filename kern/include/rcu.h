@@ -0,0 +1,49 @@
+#ifndef _RCU_H_
+#define _RCU_H_
+
+/*
+ * Read-copy-update style deferred reclamation.
+ *
+ * Readers bracket lookups of shared pointers with rcu_read_lock and
+ * rcu_read_unlock. These take no lock and touch only the current
+ * thread; the thread just isn't preempted in between, and must not
+ * sleep. Writers unpublish an object (under whatever lock they use
+ * among themselves) and then free it only after a grace period, by
+ * which time every reader that might have seen it is done.
+ *
+ * Grace periods are detected from quiescent states: each cpu passes
+ * through one whenever it switches threads (see thread_switch) or
+ * takes a timer tick outside a read section (see thread_timeslice),
+ * and an idle cpu is always quiescent.
+ *
+ * rcu_synchronize waits for a grace period to go by; it sleeps, so
+ * it can't be called from an interrupt handler or holding a spinlock.
+ *
+ * rcu_call arranges for FUNC(DATA) to be called, in thread context,
+ * some time after a grace period starting now. HEAD is storage for
+ * the bookkeeping, usually embedded in the object being freed. It
+ * may be called from anywhere.
+ */
+
+struct rcu_head {
+	struct rcu_head *rh_next;	/* Next callback waiting */
+	void (*rh_func)(void *);	/* Function to call */
+	void *rh_data;			/* Argument for rh_func */
+};
+
+/* Call once, during startup. */
+void rcu_bootstrap(void);
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+
+void rcu_synchronize(void);
+void rcu_call(struct rcu_head *head, void (*func)(void *), void *data);
+
+/*
+ * Called by thread_switch, and by thread_timeslice when the thread it
+ * interrupted isn't reading, to note a quiescent state on this cpu.
+ */
+void rcu_quiescent(void);
+
+#endif /* _RCU_H_ */
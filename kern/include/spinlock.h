@@ -37,6 +37,8 @@
 
 #include <cdefs.h>
 #include <hangman.h>
+#include "opt-ticket_spinlock.h"
+#include "opt-lockstat.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -56,21 +58,46 @@
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
+#if OPT_TICKET_SPINLOCK
+	volatile spinlock_data_t splk_next; /* Next ticket to hand out. */
+	volatile spinlock_data_t splk_serving; /* Ticket allowed in. */
+#else
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+#endif
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
+#if OPT_LOCKSTAT
+	vaddr_t splk_site;		    /* Where the holder acquired it. */
+	uint64_t splk_since;		    /* When it did (cycles). */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
-				  HANGMAN_LOCKABLE_INITIALIZER }
+#if OPT_TICKET_SPINLOCK
+#define SPINLOCK_DATA_INITIALIZERS \
+	SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER
+#else
+#define SPINLOCK_DATA_INITIALIZERS	SPINLOCK_DATA_INITIALIZER
+#endif
+
+#if OPT_HANGMAN
+#define SPINLOCK_HANGMAN_INITIALIZER	, HANGMAN_LOCKABLE_INITIALIZER
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_HANGMAN_INITIALIZER
 #endif
 
+#if OPT_LOCKSTAT
+#define SPINLOCK_LOCKSTAT_INITIALIZERS	, 0, 0
+#else
+#define SPINLOCK_LOCKSTAT_INITIALIZERS
+#endif
+
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZERS, NULL \
+				  SPINLOCK_HANGMAN_INITIALIZER \
+				  SPINLOCK_LOCKSTAT_INITIALIZERS }
+
 /*
  * Spinlock functions.
  *
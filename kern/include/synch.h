@@ -36,10 +36,12 @@
 
 
 #include <spinlock.h>
+#include <wchan.h>
 
 #include "opt-lock_with_semaphores.h"
 #include "opt-lock_wchan_spinlock.h"
 #include "opt-cv_implementation.h"
+#include "opt-lockstat.h"
 
 /*
  * Dijkstra-style semaphore.
@@ -50,8 +52,12 @@
 struct semaphore {
         char *sem_name;
 	struct wchan *sem_wchan;
+#if OPT_HASHED_WCHAN
+	struct wchan sem_wchandata;     // what sem_wchan points to
+#endif
 	struct spinlock sem_lock;
         volatile unsigned sem_count;
+        volatile unsigned sem_sleepers;         // threads in P's slow path
 };
 
 struct semaphore *sem_create(const char *name, unsigned initial_count);
@@ -66,6 +72,12 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * Like P, but give up and return ETIMEDOUT if the count doesn't
+ * become available within TICKS hardclocks. Returns 0 on success.
+ */
+int sem_timedP(struct semaphore *, unsigned ticks);
+
 /*
  * Simple lock for mutual exclusion.
  *
@@ -83,18 +95,35 @@ struct lock
         // (don't forget to mark things volatile as needed)
 
 #if OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK
-        struct thread *owner;
+        // owning thread, or'd with LOCK_CONTENDED if releasing it
+        // must go through the spinlock (see lock_acquire)
+        volatile spinlock_data_t lk_owner;
         struct spinlock spinlock;
 
+        // for priority inheritance (see thread.c)
+        struct thread *lk_waiters;      // threads waiting for the lock
+        struct lock *lk_nextheld;       // next lock held by the owner
+
+#if OPT_LOCKSTAT
+        uint64_t lk_since;              // when the owner got it (cycles)
+#endif
+
 #if OPT_LOCK_WITH_SEMAPHORES
         struct semaphore *sem;
 #else
         struct wchan *lk_wchan;
+#if OPT_HASHED_WCHAN
+        struct wchan lk_wchandata;      // what lk_wchan points to
+#endif
 #endif
 
 #endif
 };
 
+#define LOCK_CONTENDED          0x1
+#define LOCK_OWNER(lk) \
+        ((struct thread *)(uintptr_t)((lk)->lk_owner & ~LOCK_CONTENDED))
+
 struct lock *lock_create(const char *name);
 void lock_destroy(struct lock *);
 
@@ -134,6 +163,9 @@ struct cv {
         // (don't forget to mark things volatile as needed)
 #if (OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK) && OPT_CV_IMPLEMENTATION
         struct wchan *cv_wchan;
+#if OPT_HASHED_WCHAN
+        struct wchan cv_wchandata;      // what cv_wchan points to
+#endif
         struct spinlock spinlock;
 #endif  
 };
@@ -158,4 +190,129 @@ void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ * Like cv_wait, but wake up after TICKS hardclocks even if nobody
+ * signals. Returns ETIMEDOUT if that's what happened, or 0. As with
+ * cv_wait, the caller should recheck its condition either way.
+ */
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at once, or a single
+ * writer. Neither kind of hold is recursive.
+ *
+ * FLAGS picks the policy when both readers and writers want the lock:
+ *    0                  - reader preference: readers get in whenever no
+ *                         writer holds the lock. Writers can starve.
+ *    RWLOCK_WRITERPREF  - new readers wait while a writer is waiting.
+ *                         Readers can starve.
+ *    RWLOCK_FAIR        - like RWLOCK_WRITERPREF, but when a writer
+ *                         releases the lock, the readers that were
+ *                         waiting for it go in before the next writer.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+#define RWLOCK_WRITERPREF       0x1
+#define RWLOCK_FAIR             0x2
+
+struct rwlock {
+        char *rwlock_name;
+        unsigned rwlock_flags;
+        struct spinlock rwlock_lock;
+        struct wchan *rwlock_rwchan;    // readers waiting
+        struct wchan *rwlock_wwchan;    // writers waiting
+#if OPT_HASHED_WCHAN
+        struct wchan rwlock_rwchandata; // what the wchans point to
+        struct wchan rwlock_wwchandata;
+#endif
+        unsigned rwlock_readers;        // readers holding the lock
+        struct thread *rwlock_writer;   // writer holding the lock
+        unsigned rwlock_rwaiting;       // number of readers waiting
+        unsigned rwlock_wwaiting;       // number of writers waiting
+        unsigned rwlock_rpass;          // readers let past waiting writers
+};
+
+struct rwlock *rwlock_create(const char *name, unsigned flags);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing.
+ *    rwlock_release_write - Give up a write hold. Only the thread
+ *                           holding the lock for writing may do this.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+
+
+/*
+ * Barrier.
+ *
+ * A barrier for COUNT threads: each thread that calls barrier_wait
+ * sleeps until COUNT threads have, and then all of them are let go
+ * at once. It can be used again right away for the next round.
+ *
+ * barrier_wait returns true in exactly one of the threads of each
+ * round (the last one to arrive), e.g. for doing per-round work.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct barrier {
+        char *barrier_name;
+        struct spinlock barrier_lock;
+        struct wchan *barrier_wchan;
+#if OPT_HASHED_WCHAN
+        struct wchan barrier_wchandata; // what barrier_wchan points to
+#endif
+        unsigned barrier_count;         // threads per round
+        unsigned barrier_waiting;       // threads arrived this round
+        unsigned barrier_round;         // bumped as each round ends
+};
+
+struct barrier *barrier_create(const char *name, unsigned count);
+void barrier_destroy(struct barrier *);
+
+bool barrier_wait(struct barrier *);
+
+/*
+ * Note that barrier_destroy may not be called until every thread of
+ * the last round has returned from barrier_wait, not just arrived.
+ */
+
+
+/*
+ * Countdown latch.
+ *
+ * Starts at COUNT. latch_countdown takes one off (never blocking, so
+ * it may be called from an interrupt handler); latch_wait sleeps
+ * until it gets to zero, and returns at once from then on. Unlike a
+ * barrier it is used only once.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct latch {
+        char *latch_name;
+        struct spinlock latch_lock;
+        struct wchan *latch_wchan;
+#if OPT_HASHED_WCHAN
+        struct wchan latch_wchandata;   // what latch_wchan points to
+#endif
+        unsigned latch_count;
+};
+
+struct latch *latch_create(const char *name, unsigned count);
+void latch_destroy(struct latch *);
+
+void latch_countdown(struct latch *);
+void latch_wait(struct latch *);
+
 #endif /* _SYNCH_H_ */
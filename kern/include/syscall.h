@@ -65,18 +65,30 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(userptr_t user_req, userptr_t user_rem);
+int sys_sched_setaffinity(uint32_t mask);
+int sys_sched_getaffinity(userptr_t user_mask);
+int sys_futex_wait(userptr_t user_addr, int val);
+int sys_futex_wake(userptr_t user_addr, int n, int32_t *retval);
+
+/* Set up the futex wait queues. */
+void futex_bootstrap(void);
 
 #if OPT_ASST1
 // implemented in syscall/file_syscalls.c
-ssize_t sys_write(int filehandle, const void *buf, size_t size);
-ssize_t sys_read(int filehandle, void *buf, size_t size);
+int sys_write(int fd, userptr_t buf, size_t size, int32_t *retval);
+int sys_read(int fd, userptr_t buf, size_t size, int32_t *retval);
+int sys_open(userptr_t user_path, int flags, mode_t mode, int32_t *retval);
+int sys_close(int fd);
+int sys_lseek(int fd, off_t pos, int whence, off_t *retval);
 
 // implemented in syscall/proc_syscalls.c
 int sys_exit(struct thread* calling_thread, int exit_code);
 #endif
 
 // implemented in syscall/proc_syscalls.c
-int sys_waitpid (pid_t pid, int *returncode, int flags);
+int sys_waitpid (pid_t pid, userptr_t returncode, int flags,
+                 int32_t *retval);
 
 int sys_fork (struct trapframe *tf, pid_t *child_pid);
 pid_t sys_getpid (void);
@@ -50,10 +50,22 @@ int threadlisttest(int, char **);
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadtest4(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
+int lockbench(int, char **);
+int barriertest(int, char **);
+int rwtest1(int, char **);
+int rwtest2(int, char **);
+int rwtest3(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int workqueuetest1(int, char **);
+int workqueuetest2(int, char **);
+int destroytest1(int, char **);
+int destroytest2(int, char **);
+int rcutest1(int, char **);
+int rcutest2(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -40,7 +40,10 @@
 #include <spinlock.h>
 #include <threadlist.h>
 
+#include "opt-hashed_wchan.h"
+
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -55,6 +58,12 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/* Names shorter than this are stored in the thread itself */
+#define THREAD_NAMELEN 16
+
+
+/* Affinity mask allowing every cpu. */
+#define THREAD_AFFINITY_ALL 0xffffffff
 
 /* States a thread can be in. */
 typedef enum {
@@ -72,6 +81,9 @@ struct thread {
 	 */
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
+#if OPT_HASHED_WCHAN
+	struct wchan *t_wchan;		/* Wait channel, if sleeping */
+#endif
 	threadstate_t t_state;		/* State this thread is in */
 
 	/*
@@ -83,6 +95,7 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	char t_namebuf[THREAD_NAMELEN];	/* Storage for short names */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
 	/*
@@ -102,6 +115,50 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Scheduler fields.
+	 *
+	 * The scheduler is a multi-level feedback queue: threads run
+	 * at priority level t_priority (0 is the highest) and are
+	 * demoted one level each time they use up the quantum for
+	 * their level, which is tracked in t_ticks. All threads are
+	 * periodically boosted back to level 0; t_epoch records the
+	 * boost epoch a sleeping thread last saw so it can catch up
+	 * when it wakes. See schedule() in thread.c.
+	 *
+	 * While the thread is on a run queue these are protected by
+	 * that run queue's lock.
+	 */
+	unsigned t_priority;		/* Scheduling level */
+	unsigned t_ticks;		/* Hardclocks used at this level */
+	unsigned t_epoch;		/* Boost epoch last seen */
+
+	/*
+	 * Priority inheritance. A thread waiting for a lock lends its
+	 * level to the owner, which runs at the better of t_priority
+	 * and t_inherited. See thread_pi_block() in thread.c.
+	 */
+	unsigned t_inherited;		/* Level lent by lock waiters */
+	struct lock *t_waitlock;	/* Lock we're waiting for */
+	struct thread *t_nextwaiter;	/* Next waiter for t_waitlock */
+	struct lock *t_heldlocks;	/* Locks we hold */
+
+	/*
+	 * Placement fields.
+	 *
+	 * t_affinity is the set of cpus the thread may run on, one bit
+	 * per cpu number; only the thread itself changes it. t_lastrun
+	 * is the value of t_cpu's c_hardclocks when the thread last
+	 * stopped running there, which tells us whether its cache
+	 * footprint on that cpu is likely to be warm still.
+	 */
+	uint32_t t_affinity;		/* Cpus this thread may run on */
+	unsigned t_lastrun;		/* Hardclock it last ran on t_cpu */
+	unsigned t_migrations;		/* Times moved to another cpu */
+
+	/* Depth of rcu_read_lock nesting; no preemption while nonzero */
+	unsigned t_rcu_nest;
+
 	/*
 	 * Public fields
 	 */
@@ -165,10 +222,32 @@ void thread_yield(void);
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Charge the current thread for a hardclock tick, and preempt it if
+ * its quantum has run out or a higher-priority thread is waiting.
+ * Called from the timer interrupt.
+ */
+void thread_timeslice(void);
+
+/*
+ * Restrict the current thread to the cpus whose bits are set in MASK
+ * (bit N is cpu number N), moving it right away if it's running on
+ * a cpu not in the mask. Bits for nonexistent cpus are ignored;
+ * returns EINVAL if no existing cpu is left.
+ *
+ * thread_getaffinity returns the current thread's mask.
+ */
+int thread_setaffinity(uint32_t mask);
+uint32_t thread_getaffinity(void);
+
+/*
+ * Priority inheritance hooks for the lock code: the current thread
+ * is about to wait for LK (with LK's spinlock held), has stopped
+ * waiting, has acquired it, or has released it.
  */
-void thread_consider_migration(void);
+void thread_pi_block(struct lock *lk);
+void thread_pi_unblock(struct lock *lk);
+void thread_pi_acquired(struct lock *lk);
+void thread_pi_released(struct lock *lk);
 
 
 #endif /* _THREAD_H_ */
@@ -35,8 +35,30 @@
  */
 
 
+#include "opt-hashed_wchan.h"
+
 struct spinlock; /* in spinlock.h */
+
+#if OPT_HASHED_WCHAN
+/*
+ * With hashed wait channels the sleeping threads are kept in a global
+ * table keyed by the wchan's address, so a wchan is only a name and
+ * can be embedded in the object that sleeps on it instead of being
+ * created and destroyed with it. Don't look inside.
+ */
+struct wchan {
+	const char *wc_name;
+};
+
+/*
+ * Initialize and clean up an embedded wait channel. The same rules
+ * about NAME and about waiters apply as for create and destroy.
+ */
+void wchan_init(struct wchan *wc, const char *name);
+void wchan_cleanup(struct wchan *wc);
+#else
 struct wchan; /* Opaque */
+#endif
 
 /*
  * Create a wait channel. Use NAME as a symbolic name for the channel.
@@ -52,7 +74,8 @@ void wchan_destroy(struct wchan *wc);
 
 /*
  * Return nonzero if there are no threads sleeping on the channel.
- * This is meant to be used only for diagnostic purposes.
+ * The associated spinlock must be locked, and the answer is only
+ * good for as long as it stays locked.
  */
 bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
 
@@ -66,6 +89,14 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_sleep, but give up after TICKS hardclocks. Returns true
+ * if the sleep timed out rather than being woken up. The associated
+ * lock is released and reacquired once more after waking, so the
+ * caller should recheck its condition either way.
+ */
+bool wchan_timedsleep(struct wchan *wc, struct spinlock *lk, unsigned ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
@@ -76,5 +107,18 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Move one thread (or all threads, if ALL is true) sleeping on FROM
+ * to TO, without waking them. They will be woken by a wakeup on TO
+ * instead. Both associated spinlocks must be locked.
+ *
+ * The threads still return from the wchan_sleep they went to sleep
+ * with, relocking FROM's spinlock, so this is only useful when the
+ * caller knows they will go on to wait for whatever TO stands for.
+ * A wchan_timedsleep on FROM no longer times out once moved.
+ */
+void wchan_transfer(struct wchan *from, struct spinlock *fromlk,
+		    struct wchan *to, struct spinlock *tolk, bool all);
+
 
 #endif /* _WCHAN_H_ */
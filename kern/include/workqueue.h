@@ -0,0 +1,43 @@
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+#include <spinlock.h>
+
+/*
+ * Deferred work.
+ *
+ * Each cpu has a queue of work items, run in order by a small pool
+ * of kernel threads (belonging to kproc) pinned to that cpu. Work
+ * functions run in thread context, so unlike interrupt handlers they
+ * may sleep, take locks, and do I/O.
+ *
+ * A work item is allocated by the caller, usually embedded in some
+ * other structure. It can be queued again once its function has
+ * started; the function may free it.
+ *
+ * Queueing claims the item by setting wk_queued with an atomic
+ * test-and-set, so two cpus queueing it at once can't both put it
+ * on their queues. The worker releases the claim when it takes the
+ * item off its queue, before calling wk_func.
+ */
+struct work {
+	struct work *wk_next;		/* Next item on the queue */
+	volatile spinlock_data_t wk_queued;	/* 1 while on a queue */
+	void (*wk_func)(void *);	/* Function to call */
+	void *wk_data;			/* Argument for wk_func */
+};
+
+/* Call once, after the secondary cpus are started. */
+void workqueue_bootstrap(void);
+
+/* Prepare a work item to call FUNC(DATA). */
+void work_init(struct work *wk, void (*func)(void *), void *data);
+
+/*
+ * Queue a work item on the current cpu. Returns false, doing nothing,
+ * if it's already queued. May be called from an interrupt handler.
+ */
+bool work_queue(struct work *wk);
+
+#endif /* _WORKQUEUE_H_ */
@@ -45,6 +45,8 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <vfs.h>
+#include <workqueue.h>
+#include <rcu.h>
 #include <device.h>
 #include <syscall.h>
 #include <test.h>
@@ -129,6 +131,9 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	workqueue_bootstrap();
+	rcu_bootstrap();
+	futex_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -43,8 +43,10 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockstat.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockstat.h"
 
 #include "opt-wait_pid.h"
 
@@ -139,9 +141,9 @@ common_prog(int nargs, char **args)
 	}
 
 #if OPT_WAIT_PID
-	//exit_code = proc_wait(proc);
-	if (sys_waitpid(proc->pid, &exit_code, 0) == -1) {
-		kprintf("\nError calling sys_waitpid");
+	// exit_code is a kernel pointer, so skip sys_waitpid's copyout
+	if (proc_wait(proc->pid, 0, &exit_code) < 0) {
+		kprintf("\nError calling proc_wait");
 	} else {
 		kprintf("\nProcess terminated with exit code %d\n", exit_code);	
 	}
@@ -509,6 +511,60 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kheapprofile(int nargs, char **args)
+{
+	int rate;
+
+	if (nargs == 1) {
+		kheap_profile_dump();
+	}
+	else if ((nargs == 2 || nargs == 3) && !strcmp(args[1], "on")) {
+		rate = (nargs == 3) ? atoi(args[2]) : 16;
+		if (rate <= 0) {
+			kprintf("Usage: khprof on [rate]\n");
+			return EINVAL;
+		}
+		kheap_profile_start(rate);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		kheap_profile_stop();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		kheap_profile_reset();
+	}
+	else {
+		kprintf("Usage: khprof [on [rate] | off | reset]\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Command for lock contention statistics.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockstat_dump();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+	}
+	else {
+		kprintf("Usage: lockstat [reset]\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -578,6 +634,7 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Thread fork/exit benchmark    ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -585,6 +642,12 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] Lock contention benchmark (1) ",
+	"[sy6] Barrier test                  ",
+	"[rwt1-3] Reader-writer lock tests   ",
+	"[wqt1-2] Workqueue tests            ",
+	"[dt1-2] Destroy-after-use tests     ",
+	"[rcut1-2] RCU tests                 ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -616,6 +679,10 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khprof] Kernel heap profile        ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock statistics          ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -667,6 +734,10 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khprof",     cmd_kheapprofile },
+#if OPT_LOCKSTAT
+	{ "lockstat",   cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -683,12 +754,32 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadtest4 },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	lockbench },
+	{ "sy6",	barriertest },
+
+	/* reader-writer lock tests */
+	{ "rwt1",	rwtest1 },
+	{ "rwt2",	rwtest2 },
+	{ "rwt3",	rwtest3 },
+
+	/* workqueue tests */
+	{ "wqt1",	workqueuetest1 },
+	{ "wqt2",	workqueuetest2 },
+
+	/* destroy-after-use tests */
+	{ "dt1",	destroytest1 },
+	{ "dt2",	destroytest2 },
+
+	/* RCU tests */
+	{ "rcut1",	rcutest1 },
+	{ "rcut2",	rcutest2 },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
@@ -46,12 +46,18 @@
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
+#include <thread.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <kern/limits.h>
+#include <kern/wait.h>
 #include <kern/errno.h>
+#include <membar.h>
+#include <rcu.h>
+#include <openfile.h>
 
 #include "opt-wait_pid.h"
+#include "opt-asst1.h"
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -61,13 +67,140 @@ struct proc *kproc;
 #if OPT_WAIT_PID
 
 /*
- * Process table: each entry of the table associated the pid_t
- * identified by the array index to the corresponding process struct pointer.
- * 
- * For the sake of simplicity, __PID_MAX is reduce to 128
+ * Process table: PROC_NSLOTS slots, each holding at most one process.
+ * A pid is a slot number plus a multiple of PROC_NSLOTS, the slot's
+ * generation, so the process with a given pid can only be in slot
+ * pid % PROC_NSLOTS and both allocating a pid and looking one up are
+ * O(1). Free slots are kept in FIFO order and each slot's generation
+ * goes up every time it's used, so a pid isn't handed out again until
+ * the whole pid space has gone by.
+ *
+ * The spinlock is only for changing the table; lookups read it
+ * without locking, and processes taken out of it are freed only
+ * after an RCU grace period.
+ */
+#define PROC_NSLOTS	1024	/* most processes at once */
+#define PROC_NGENS	((__PID_MAX + 1) / PROC_NSLOTS)
+
+struct proc_slot {
+	struct proc *ps_proc;	/* process using the slot, or NULL */
+	unsigned ps_gen;	/* generation for its next pid */
+	int ps_nextfree;	/* next on free list, or -1 */
+};
+
+static struct proc_slot table[PROC_NSLOTS];
+static int table_freehead, table_freetail;
+static struct spinlock proc_table_spinlock = SPINLOCK_INITIALIZER;
+
+/*
+ * Set up the free list, in slot order.
+ */
+static
+void
+proc_table_init(void)
+{
+	int i;
+
+	for (i=0; i<PROC_NSLOTS; i++) {
+		table[i].ps_proc = NULL;
+		table[i].ps_gen = 0;
+		table[i].ps_nextfree = (i + 1 < PROC_NSLOTS) ? i + 1 : -1;
+	}
+	table_freehead = 0;
+	table_freetail = PROC_NSLOTS - 1;
+}
+
+/*
+ * Take a free slot and give its next pid to PROC. Returns false if
+ * there are none. The table must be locked.
+ */
+static
+bool
+proc_table_alloc(struct proc *proc)
+{
+	struct proc_slot *ps;
+	int slot;
+
+	slot = table_freehead;
+	if (slot < 0) {
+		return false;
+	}
+	ps = &table[slot];
+	table_freehead = ps->ps_nextfree;
+	if (table_freehead < 0) {
+		table_freetail = -1;
+	}
+
+	/* pids below __PID_MIN are reserved */
+	if (ps->ps_gen == 0 && slot < __PID_MIN) {
+		ps->ps_gen = 1;
+	}
+	proc->pid = ps->ps_gen * PROC_NSLOTS + slot;
+	ps->ps_gen = (ps->ps_gen + 1) % PROC_NGENS;
+
+	/* publish it once the rest of PROC is visible */
+	membar_store_store();
+	ps->ps_proc = proc;
+	return true;
+}
+
+/*
+ * Put PROC's slot back on the end of the free list. The table must be
+ * locked.
  */
-static struct proc* table[__PID_MAX - __PID_MIN];
-static struct spinlock proc_table_spinlock;
+static
+void
+proc_table_free(struct proc *proc)
+{
+	int slot = proc->pid % PROC_NSLOTS;
+
+	KASSERT(table[slot].ps_proc == proc);
+	table[slot].ps_proc = NULL;
+	table[slot].ps_nextfree = -1;
+	if (table_freetail < 0) {
+		table_freehead = slot;
+	}
+	else {
+		table[table_freetail].ps_nextfree = slot;
+	}
+	table_freetail = slot;
+}
+
+/*
+ * Exit lock and cv. The lock protects every process's p_parent,
+ * p_children, p_sibling and p_zombie; the cv is broadcast whenever a
+ * process with a parent becomes a zombie. Sharing one cv between all
+ * waiters costs some spurious wakeups but means a zombie needs no
+ * synchronization objects of its own, and the exiting process never
+ * touches its proc structure again after letting go of the lock, so
+ * the parent can destroy it as soon as it gets the lock back.
+ */
+static struct lock *proc_exit_lock;
+static struct cv *proc_exit_cv;
+
+/*
+ * Take CHILD off its parent's list of children. The exit lock must
+ * be held.
+ */
+static
+void
+proc_unlink_child(struct proc *child)
+{
+	struct proc **pp;
+
+	KASSERT(lock_do_i_hold(proc_exit_lock));
+	KASSERT(child->p_parent != NULL);
+
+	for (pp = &child->p_parent->p_children; *pp != NULL;
+	     pp = &(*pp)->p_sibling) {
+		if (*pp == child) {
+			*pp = child->p_sibling;
+			break;
+		}
+	}
+	child->p_parent = NULL;
+	child->p_sibling = NULL;
+}
 
 #endif
 
@@ -80,10 +213,6 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-#if OPT_WAIT_PID
-	pid_t pid;
-#endif
-
 	proc = kmalloc(sizeof(*proc));
 	if (proc == NULL) {
 		return NULL;
@@ -102,36 +231,26 @@ proc_create(const char *name)
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+#if OPT_ASST1
+	bzero(proc->p_fds, sizeof(proc->p_fds));
+#endif
 
 #if OPT_WAIT_PID
 
-	/* initialize the condition variable for process termination */
-	proc->p_exit_cv_lock = lock_create(proc->p_name);
-	if (proc->p_exit_cv_lock == NULL) {
-		kfree(proc->p_name);
-		kfree(proc);
-		return NULL;
-	}
-
-	proc->p_exit_cv = cv_create(proc->p_name);
-	if (proc->p_exit_cv == NULL) {
-		lock_destroy(proc->p_exit_cv_lock);
-		kfree(proc->p_name);
-		kfree(proc);
-		return NULL;
-	}
+	/* no family until proc_create_runprogram gives it one */
+	proc->p_parent = NULL;
+	proc->p_children = NULL;
+	proc->p_sibling = NULL;
 
 	/* set initial process exit code to 0xFFFF */
+	proc->p_zombie = false;
 	proc->p_exit_code = 0xFFFF;
 
 	spinlock_acquire(&proc_table_spinlock);
 
-	// find an assignable pid
-	for (pid = __PID_MIN; pid < __PID_MAX && table[pid - __PID_MIN]; pid++);
-	if (pid == __PID_MAX) {
-		// didn't find a valid pid
-		cv_destroy(proc->p_exit_cv);
-		lock_destroy(proc->p_exit_cv_lock);
+	// assign a pid and put it in the table
+	if (!proc_table_alloc(proc)) {
+		// no free slot
 		kfree(proc->p_name);
 		kfree(proc);
 
@@ -139,11 +258,6 @@ proc_create(const char *name)
 		return NULL;
 	}
 
-	proc->pid = pid;
-
-	/* set the entry in tha table */
-	table[pid - __PID_MIN] = proc;
-
 	spinlock_release(&proc_table_spinlock);
 
 #endif
@@ -151,6 +265,19 @@ proc_create(const char *name)
 	return proc;
 }
 
+/*
+ * Free a proc structure, once nobody can be looking at it.
+ */
+static
+void
+proc_free(void *data)
+{
+	struct proc *proc = data;
+
+	kfree(proc->p_name);
+	kfree(proc);
+}
+
 /*
  * Destroy a proc structure.
  *
@@ -171,6 +298,23 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
+#if OPT_WAIT_PID
+	// a child that never ran (fork failed) is still on its
+	// parent's list; reaped and orphaned ones are already off it
+	if (proc->p_parent != NULL) {
+		lock_acquire(proc_exit_lock);
+		proc_unlink_child(proc);
+		lock_release(proc_exit_lock);
+	}
+	KASSERT(proc->p_children == NULL);
+
+	// clear the entry in the process table first, so no new
+	// lookup finds it half torn down
+	spinlock_acquire(&proc_table_spinlock);
+	proc_table_free(proc);
+	spinlock_release(&proc_table_spinlock);
+#endif
+
 	/*
 	 * We don't take p_lock in here because we must have the only
 	 * reference to this structure. (Otherwise it would be
@@ -178,6 +322,9 @@ proc_destroy(struct proc *proc)
 	 */
 
 	/* VFS fields */
+#if OPT_ASST1
+	filetable_closeall(proc);
+#endif
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
@@ -234,18 +381,8 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc->p_numthreads == 0);
 	spinlock_cleanup(&proc->p_lock);
 
-#if OPT_WAIT_PID
-	// clear the entry in the process table
-	spinlock_acquire(&proc_table_spinlock);
-	table[proc->pid - __PID_MIN] = NULL;
-	spinlock_release(&proc_table_spinlock);
-
-	lock_destroy(proc->p_exit_cv_lock);
-	cv_destroy(proc->p_exit_cv);
-#endif
-
-	kfree(proc->p_name);
-	kfree(proc);
+	// lookups that already found it may still be reading it
+	rcu_call(&proc->p_rcu, proc_free, proc);
 }
 
 /*
@@ -254,6 +391,14 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+#if OPT_WAIT_PID
+	proc_table_init();
+	proc_exit_lock = lock_create("proc_exit");
+	proc_exit_cv = cv_create("proc_exit");
+	if (proc_exit_lock == NULL || proc_exit_cv == NULL) {
+		panic("proc_bootstrap: out of memory\n");
+	}
+#endif
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
@@ -294,6 +439,15 @@ proc_create_runprogram(const char *name)
 	}
 	spinlock_release(&curproc->p_lock);
 
+#if OPT_WAIT_PID
+	/* The creating process (the menu, or fork's caller) waits for it. */
+	lock_acquire(proc_exit_lock);
+	newproc->p_parent = curproc;
+	newproc->p_sibling = curproc->p_children;
+	curproc->p_children = newproc;
+	lock_release(proc_exit_lock);
+#endif
+
 	return newproc;
 }
 
@@ -398,37 +552,155 @@ proc_setas(struct addrspace *newas)
 #if OPT_WAIT_PID
 
 /**
- * Wait for process termination
+ * Wait for the child with pid PID to exit, reap it, and return its
+ * pid with the exit code in *EXIT_CODE. With WNOHANG, return 0 right
+ * away if it hasn't exited yet. Returns -1 if PID isn't a child of
+ * the current process.
  */
-int proc_wait (struct proc *p) {
-	int exit_code;
+pid_t proc_wait (pid_t pid, int flags, int *exit_code) {
+	struct proc *p;
+	int code;
+
+	// nobody but us can reap or orphan our own children, so once
+	// we've seen it's ours it stays put
+	rcu_read_lock();
+	p = proc_get(pid);
+	if (p == NULL || p->p_parent != curproc) {
+		rcu_read_unlock();
+		return -1;
+	}
+	rcu_read_unlock();
 
-	// acquire the spinlock of the process
-	lock_acquire(p->p_exit_cv_lock);
-	while (p->p_exit_code == 0xFFFF) { // while running
-		cv_wait(p->p_exit_cv, p->p_exit_cv_lock);
+	// polling a child that's still running takes no lock at all
+	if ((flags & WNOHANG) && !proc_exited(p, &code)) {
+		return 0;
 	}
-	exit_code = p->p_exit_code;
-	lock_release(p->p_exit_cv_lock);
 
-	// destroy the address space
+	lock_acquire(proc_exit_lock);
+	while (!p->p_zombie) {
+		cv_wait(proc_exit_cv, proc_exit_lock);
+	}
+	code = p->p_exit_code;
+	proc_unlink_child(p);
+	lock_release(proc_exit_lock);
+
+	// only the proc structure is left
 	proc_destroy(p);
 
-	return exit_code;
+	*exit_code = code;
+	return pid;
+}
+
+/**
+ * Check whether a process has exited, without taking any lock.
+ * If it has, store its exit code in *EXIT_CODE. This is only a
+ * poll: the process may not be a zombie yet, so don't destroy it
+ * without taking the exit lock and checking p_zombie.
+ */
+bool proc_exited(struct proc *p, int *exit_code) {
+	int code;
+
+	code = p->p_exit_code;
+
+	if (code == 0xFFFF) {
+		return false;
+	}
+	*exit_code = code;
+	return true;
 }
 
 /**
- * Return a struct proc given the pid
+ * Exit. The address space and current directory go right away, so a
+ * zombie is only its proc structure; children become orphans, and
+ * the ones that have already exited are reaped here since nobody
+ * else will. If we're an orphan ourselves, nobody will reap us
+ * either, so we do that too.
+ */
+void proc_exit(struct proc *p, int exit_code) {
+	struct addrspace *as;
+	struct vnode *cwd;
+	struct proc *child, *next, *reap;
+	bool orphan;
+
+	KASSERT(p != kproc);
+	KASSERT(p->p_numthreads == 0);
+
+	// the exiting thread may still have the address space loaded;
+	// see proc_destroy for why the order matters
+	spinlock_acquire(&p->p_lock);
+	as = p->p_addrspace;
+	p->p_addrspace = NULL;
+	cwd = p->p_cwd;
+	p->p_cwd = NULL;
+	spinlock_release(&p->p_lock);
+
+	if (as != NULL) {
+		as_deactivate();
+		as_destroy(as);
+	}
+	if (cwd != NULL) {
+		VOP_DECREF(cwd);
+	}
+#if OPT_ASST1
+	filetable_closeall(p);
+#endif
+
+	lock_acquire(proc_exit_lock);
+
+	// orphan the children, keeping the dead ones to reap below
+	reap = NULL;
+	for (child = p->p_children; child != NULL; child = next) {
+		next = child->p_sibling;
+		child->p_parent = NULL;
+		child->p_sibling = NULL;
+		if (child->p_zombie) {
+			child->p_sibling = reap;
+			reap = child;
+		}
+	}
+	p->p_children = NULL;
+
+	p->p_exit_code = exit_code;
+	p->p_zombie = true;
+
+	orphan = (p->p_parent == NULL);
+	if (!orphan) {
+		cv_broadcast(proc_exit_cv, proc_exit_lock);
+	}
+	// after this, unless we're an orphan, P belongs to the parent
+	lock_release(proc_exit_lock);
+
+	for (child = reap; child != NULL; child = next) {
+		next = child->p_sibling;
+		child->p_sibling = NULL;
+		proc_destroy(child);
+	}
+
+	if (orphan) {
+		proc_destroy(p);
+	}
+}
+
+/**
+ * Return a struct proc given the pid. The caller must be inside
+ * rcu_read_lock and stay there for as long as it uses the result.
  */
 struct proc *proc_get(pid_t pid) {
 	struct proc* p;
 
-	KASSERT(pid >= __PID_MIN && pid <= __PID_MAX);
-	
-	spinlock_acquire(&proc_table_spinlock);
-	p = table[pid - __PID_MIN];
-	spinlock_release(&proc_table_spinlock);
-	
+	if (pid < __PID_MIN || pid > __PID_MAX) {
+		return NULL;
+	}
+
+	// no lock; see the comment on the table. The slot may hold a
+	// different generation's process, which we mustn't return.
+	KASSERT(curthread->t_rcu_nest > 0);
+	p = table[pid % PROC_NSLOTS].ps_proc;
+	membar_load_load();
+	if (p != NULL && p->pid != pid) {
+		p = NULL;
+	}
+
 	return p;
 }
 
@@ -443,6 +715,11 @@ struct proc *proc_fork(struct proc *old) {
 	// copy the address space from the father process
 	as_copy(old->p_addrspace, &new->p_addrspace);
 
+#if OPT_ASST1
+	// and share its open files
+	filetable_copy(old, new);
+#endif
+
 	return new;
 }
 
@@ -1,28 +1,182 @@
 #include <types.h>
 #include <lib.h>
 #include <syscall.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <copyinout.h>
+#include <openfile.h>
 
+#include <limits.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <kern/stat.h>
 #include <kern/unistd.h>
 
-ssize_t sys_write(int filehandle, const void *buf, size_t size)
+/*
+ * Read or write SIZE bytes at BUF through descriptor FD, at the open
+ * file's current offset, and advance the offset by what was moved.
+ */
+static int file_io(int fd, userptr_t buf, size_t size, enum uio_rw rw,
+                   int32_t *retval)
 {
-    // check if the file handle is STDOUT_FILENO
-    KASSERT(filehandle == STDOUT_FILENO || filehandle == STDERR_FILENO);
+    struct openfile *of;
+    struct iovec iov;
+    struct uio u;
+    struct stat st;
+    int accmode;
+    int result;
 
-    size_t i = 0;
-    while (i < size)
-        putch(*((char *)buf + (i++)));
+    result = filetable_get(curproc, fd, &of);
+    if (result) {
+        return result;
+    }
 
-    return size;
+    accmode = of->of_flags & O_ACCMODE;
+    if ((rw == UIO_READ && accmode == O_WRONLY) ||
+        (rw == UIO_WRITE && accmode == O_RDONLY)) {
+        openfile_decref(of);
+        return EBADF;
+    }
+
+    // held across the I/O so that processes sharing the file
+    // each get their own stretch of it
+    lock_acquire(of->of_offsetlock);
+
+    if (rw == UIO_WRITE && (of->of_flags & O_APPEND)) {
+        result = VOP_STAT(of->of_vnode, &st);
+        if (result) {
+            goto out;
+        }
+        of->of_offset = st.st_size;
+    }
+
+    iov.iov_ubase = buf;
+    iov.iov_len = size;
+    u.uio_iov = &iov;
+    u.uio_iovcnt = 1;
+    u.uio_offset = of->of_offset;
+    u.uio_resid = size;
+    u.uio_segflg = UIO_USERSPACE;
+    u.uio_rw = rw;
+    u.uio_space = proc_getas();
+
+    if (rw == UIO_READ) {
+        result = VOP_READ(of->of_vnode, &u);
+    }
+    else {
+        result = VOP_WRITE(of->of_vnode, &u);
+    }
+    if (result == 0) {
+        of->of_offset = u.uio_offset;
+        *retval = size - u.uio_resid;
+    }
+
+out:
+    lock_release(of->of_offsetlock);
+    openfile_decref(of);
+    return result;
+}
+
+int sys_write(int fd, userptr_t buf, size_t size, int32_t *retval)
+{
+    return file_io(fd, buf, size, UIO_WRITE, retval);
+}
+
+int sys_read(int fd, userptr_t buf, size_t size, int32_t *retval)
+{
+    return file_io(fd, buf, size, UIO_READ, retval);
 }
 
-ssize_t sys_read(int filehandle, void *buf, size_t size) {
-    // check if the file handle is STDOUT_FILENO
-    KASSERT(filehandle == STDIN_FILENO);
+int sys_open(userptr_t user_path, int flags, mode_t mode, int32_t *retval)
+{
+    struct openfile *of;
+    char *path;
+    int fd;
+    int result;
+
+    if (flags & ~(O_ACCMODE | O_CREAT | O_EXCL | O_TRUNC | O_APPEND)) {
+        return EINVAL;
+    }
+
+    path = kmalloc(PATH_MAX);
+    if (path == NULL) {
+        return ENOMEM;
+    }
+    result = copyinstr(user_path, path, PATH_MAX, NULL);
+    if (result == 0) {
+        result = openfile_open(path, flags, mode, &of);
+    }
+    kfree(path);
+    if (result) {
+        return result;
+    }
 
-    size_t i = 0;
-    while (i < size)
-        *((char *)buf + (i++)) = getch();
+    result = filetable_place(curproc, of, &fd);
+    if (result) {
+        openfile_decref(of);
+        return result;
+    }
 
-    return size;
-}
\ No newline at end of file
+    *retval = fd;
+    return 0;
+}
+
+int sys_close(int fd)
+{
+    return filetable_remove(curproc, fd);
+}
+
+int sys_lseek(int fd, off_t pos, int whence, off_t *retval)
+{
+    struct openfile *of;
+    struct stat st;
+    off_t newpos;
+    int result;
+
+    result = filetable_get(curproc, fd, &of);
+    if (result) {
+        return result;
+    }
+
+    if (!VOP_ISSEEKABLE(of->of_vnode)) {
+        openfile_decref(of);
+        return ESPIPE;
+    }
+
+    lock_acquire(of->of_offsetlock);
+
+    switch (whence) {
+    case SEEK_SET:
+        newpos = pos;
+        break;
+    case SEEK_CUR:
+        newpos = of->of_offset + pos;
+        break;
+    case SEEK_END:
+        result = VOP_STAT(of->of_vnode, &st);
+        if (result) {
+            goto out;
+        }
+        newpos = st.st_size + pos;
+        break;
+    default:
+        result = EINVAL;
+        goto out;
+    }
+
+    if (newpos < 0) {
+        result = EINVAL;
+        goto out;
+    }
+    of->of_offset = newpos;
+    *retval = newpos;
+
+out:
+    lock_release(of->of_offsetlock);
+    openfile_decref(of);
+    return result;
+}
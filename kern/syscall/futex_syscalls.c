@@ -0,0 +1,223 @@
+/*
+ * Futex-style wait/wake on user addresses.
+ *
+ * Userland keeps the lock (or whatever) in an ordinary word of its
+ * own memory and only calls in when it has to wait or when someone
+ * might be waiting. Waiters are hashed by address space and address
+ * into buckets; each bucket has a spinlock, a list of waiters, and a
+ * wait channel they sleep on.
+ *
+ * futex_wait queues the waiter before looking at the user word, so a
+ * futex_wake that comes after the user word was changed will always
+ * find it: either the waiter sees the new value and leaves, or it is
+ * already on the list and gets woken. A waiter that is woken in that
+ * window but then leaves anyway hands its wake to the next waiter, so
+ * the wake is not lost. Waiters are queued at the tail and woken from
+ * the head, oldest first.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <syscall.h>
+
+#define FUTEX_NBUCKETS	64
+
+struct futex_waiter {
+	struct addrspace *fw_as;
+	vaddr_t fw_addr;
+	bool fw_woken;
+	struct futex_waiter *fw_next;
+};
+
+struct futex_bucket {
+	struct spinlock fb_lock;
+	struct wchan *fb_wchan;
+	struct futex_waiter *fb_waiters;
+	struct futex_waiter **fb_tailp;		/* last fw_next in the list */
+};
+
+static struct futex_bucket futex_buckets[FUTEX_NBUCKETS];
+
+void
+futex_bootstrap(void)
+{
+	struct futex_bucket *fb;
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		fb = &futex_buckets[i];
+		spinlock_init(&fb->fb_lock);
+		fb->fb_wchan = wchan_create("futex");
+		if (fb->fb_wchan == NULL) {
+			panic("futex_bootstrap: wchan_create failed\n");
+		}
+		fb->fb_waiters = NULL;
+		fb->fb_tailp = &fb->fb_waiters;
+	}
+}
+
+static
+struct futex_bucket *
+futex_bucket(struct addrspace *as, vaddr_t addr)
+{
+	uint32_t h;
+
+	h = (uint32_t)(uintptr_t)as ^ (addr >> 2);
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return &futex_buckets[h % FUTEX_NBUCKETS];
+}
+
+/*
+ * Take the waiter *P points at off FB's list.
+ */
+static
+void
+futex_remove(struct futex_bucket *fb, struct futex_waiter **p)
+{
+	struct futex_waiter *fw = *p;
+
+	*p = fw->fw_next;
+	if (fb->fb_tailp == &fw->fw_next) {
+		fb->fb_tailp = p;
+	}
+	fw->fw_next = NULL;
+}
+
+/*
+ * Take FW off its bucket's list, if it's still there.
+ */
+static
+void
+futex_unlink(struct futex_bucket *fb, struct futex_waiter *fw)
+{
+	struct futex_waiter **p;
+
+	KASSERT(spinlock_do_i_hold(&fb->fb_lock));
+
+	for (p = &fb->fb_waiters; *p != NULL; p = &(*p)->fw_next) {
+		if (*p == fw) {
+			futex_remove(fb, p);
+			return;
+		}
+	}
+}
+
+/*
+ * Mark up to N waiters on AS/ADDR woken, oldest first, and take them
+ * off the list. Returns how many there were.
+ */
+static
+int
+futex_wake_locked(struct futex_bucket *fb, struct addrspace *as,
+		  vaddr_t addr, int n)
+{
+	struct futex_waiter **p, *fw;
+	int woken;
+
+	KASSERT(spinlock_do_i_hold(&fb->fb_lock));
+
+	woken = 0;
+	p = &fb->fb_waiters;
+	while (*p != NULL && woken < n) {
+		fw = *p;
+		if (fw->fw_as == as && fw->fw_addr == addr) {
+			futex_remove(fb, p);
+			fw->fw_woken = true;
+			woken++;
+		}
+		else {
+			p = &fw->fw_next;
+		}
+	}
+	if (woken > 0) {
+		wchan_wakeall(fb->fb_wchan, &fb->fb_lock);
+	}
+	return woken;
+}
+
+/*
+ * Sleep until woken by futex_wake on USER_ADDR, unless the word there
+ * no longer contains VAL, in which case fail with EAGAIN.
+ */
+int
+sys_futex_wait(userptr_t user_addr, int val)
+{
+	struct futex_waiter fw;
+	struct futex_bucket *fb;
+	int cur;
+	int result;
+
+	if ((vaddr_t)user_addr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	fw.fw_as = proc_getas();
+	fw.fw_addr = (vaddr_t)user_addr;
+	fw.fw_woken = false;
+	fw.fw_next = NULL;
+	fb = futex_bucket(fw.fw_as, fw.fw_addr);
+
+	spinlock_acquire(&fb->fb_lock);
+	*fb->fb_tailp = &fw;
+	fb->fb_tailp = &fw.fw_next;
+	spinlock_release(&fb->fb_lock);
+
+	/* copyin can fault and sleep, so it can't be under fb_lock. */
+	result = copyin(user_addr, &cur, sizeof(cur));
+	if (result == 0 && cur != val) {
+		result = EAGAIN;
+	}
+
+	spinlock_acquire(&fb->fb_lock);
+	if (result) {
+		if (fw.fw_woken) {
+			/* Counted as woken but not staying; pass it on. */
+			futex_wake_locked(fb, fw.fw_as, fw.fw_addr, 1);
+		}
+		else {
+			futex_unlink(fb, &fw);
+		}
+	}
+	else {
+		/* Others hashed to this bucket wake us too; check. */
+		while (!fw.fw_woken) {
+			wchan_sleep(fb->fb_wchan, &fb->fb_lock);
+		}
+	}
+	spinlock_release(&fb->fb_lock);
+
+	return result;
+}
+
+/*
+ * Wake up to N threads waiting on USER_ADDR. The number woken is
+ * handed back in RETVAL.
+ */
+int
+sys_futex_wake(userptr_t user_addr, int n, int32_t *retval)
+{
+	struct futex_bucket *fb;
+	struct addrspace *as;
+	vaddr_t addr;
+
+	if ((vaddr_t)user_addr % sizeof(int) != 0 || n < 0) {
+		return EINVAL;
+	}
+
+	as = proc_getas();
+	addr = (vaddr_t)user_addr;
+	fb = futex_bucket(as, addr);
+
+	spinlock_acquire(&fb->fb_lock);
+	*retval = futex_wake_locked(fb, as, addr, n);
+	spinlock_release(&fb->fb_lock);
+
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Open files and file descriptor tables. See openfile.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/unistd.h>
+#include <limits.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <proc.h>
+#include <openfile.h>
+
+/*
+ * Open a file and wrap it in an openfile with one reference.
+ */
+int
+openfile_open(char *path, int flags, mode_t mode, struct openfile **ret)
+{
+	struct openfile *of;
+	struct vnode *vn;
+	int result;
+
+	of = kmalloc(sizeof(*of));
+	if (of == NULL) {
+		return ENOMEM;
+	}
+	of->of_offsetlock = lock_create("openfile");
+	if (of->of_offsetlock == NULL) {
+		kfree(of);
+		return ENOMEM;
+	}
+
+	result = vfs_open(path, flags, mode, &vn);
+	if (result) {
+		lock_destroy(of->of_offsetlock);
+		kfree(of);
+		return result;
+	}
+
+	of->of_vnode = vn;
+	of->of_flags = flags;
+	of->of_offset = 0;
+	spinlock_init(&of->of_reflock);
+	of->of_refcount = 1;
+
+	*ret = of;
+	return 0;
+}
+
+void
+openfile_incref(struct openfile *of)
+{
+	spinlock_acquire(&of->of_reflock);
+	of->of_refcount++;
+	spinlock_release(&of->of_reflock);
+}
+
+void
+openfile_decref(struct openfile *of)
+{
+	bool last;
+
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount--;
+	last = (of->of_refcount == 0);
+	spinlock_release(&of->of_reflock);
+
+	if (last) {
+		vfs_close(of->of_vnode);
+		lock_destroy(of->of_offsetlock);
+		spinlock_cleanup(&of->of_reflock);
+		kfree(of);
+	}
+}
+
+int
+filetable_place(struct proc *p, struct openfile *of, int *fd)
+{
+	int i;
+
+	spinlock_acquire(&p->p_lock);
+	for (i=0; i<OPEN_MAX; i++) {
+		if (p->p_fds[i] == NULL) {
+			p->p_fds[i] = of;
+			spinlock_release(&p->p_lock);
+			*fd = i;
+			return 0;
+		}
+	}
+	spinlock_release(&p->p_lock);
+	return EMFILE;
+}
+
+int
+filetable_get(struct proc *p, int fd, struct openfile **ret)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	spinlock_acquire(&p->p_lock);
+	of = p->p_fds[fd];
+	if (of != NULL) {
+		openfile_incref(of);
+	}
+	spinlock_release(&p->p_lock);
+
+	if (of == NULL) {
+		return EBADF;
+	}
+	*ret = of;
+	return 0;
+}
+
+int
+filetable_remove(struct proc *p, int fd)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	spinlock_acquire(&p->p_lock);
+	of = p->p_fds[fd];
+	p->p_fds[fd] = NULL;
+	spinlock_release(&p->p_lock);
+
+	if (of == NULL) {
+		return EBADF;
+	}
+	/* vfs_close can sleep, so not under p_lock */
+	openfile_decref(of);
+	return 0;
+}
+
+void
+filetable_copy(struct proc *from, struct proc *to)
+{
+	struct openfile *of;
+	int i;
+
+	/* TO is new; nobody else is looking at its table */
+	spinlock_acquire(&from->p_lock);
+	for (i=0; i<OPEN_MAX; i++) {
+		of = from->p_fds[i];
+		KASSERT(to->p_fds[i] == NULL);
+		if (of != NULL) {
+			openfile_incref(of);
+			to->p_fds[i] = of;
+		}
+	}
+	spinlock_release(&from->p_lock);
+}
+
+void
+filetable_closeall(struct proc *p)
+{
+	int i;
+
+	for (i=0; i<OPEN_MAX; i++) {
+		if (p->p_fds[i] != NULL) {
+			filetable_remove(p, i);
+		}
+	}
+}
+
+int
+filetable_openconsole(struct proc *p)
+{
+	static const int flags[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+	struct openfile *of;
+	char path[5];
+	int fd, result;
+
+	for (fd=STDIN_FILENO; fd<=STDERR_FILENO; fd++) {
+		KASSERT(p->p_fds[fd] == NULL);
+
+		/* vfs_open destroys the path */
+		strcpy(path, "con:");
+		result = openfile_open(path, flags[fd], 0, &of);
+		if (result) {
+			return result;
+		}
+		spinlock_acquire(&p->p_lock);
+		p->p_fds[fd] = of;
+		spinlock_release(&p->p_lock);
+	}
+	return 0;
+}
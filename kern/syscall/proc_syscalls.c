@@ -8,8 +8,10 @@
 #include <proc.h>
 #include <current.h>
 #include <mips/trapframe.h>
+#include <copyinout.h>
 
 #include <kern/unistd.h>
+#include <kern/wait.h>
 #include <kern/errno.h>
 
 #include "opt-wait_pid.h"
@@ -27,11 +29,8 @@ int sys_exit(struct thread* calling_thread, int exit_code) {
 
 #if OPT_WAIT_PID
 
-    // set the exit code and signal the conditional variable
-    lock_acquire(proc->p_exit_cv_lock);
-    proc->p_exit_code = exit_code & 0x0377;
-    cv_broadcast(proc->p_exit_cv, proc->p_exit_cv_lock);
-    lock_release(proc->p_exit_cv_lock);
+    // free everything but the exit code and let the parent know
+    proc_exit(proc, exit_code & 0x0377);
 
 #else 
     
@@ -45,30 +44,38 @@ int sys_exit(struct thread* calling_thread, int exit_code) {
     return 0;
 }
 
-int sys_waitpid (pid_t pid, int *returncode, int flags) {
+int sys_waitpid (pid_t pid, userptr_t returncode, int flags,
+                 int32_t *retval) {
 
 #if OPT_WAIT_PID
     int status;
+    pid_t result;
 
-    (void)flags;
-
-    struct proc *p = proc_get(pid);
-    if (p == NULL) {
-        return -1;
+    if (flags & ~WNOHANG) {
+        return EINVAL;
     }
 
-    status = proc_wait(p);
-    if (returncode) {
-        *returncode = status;
+    // 0 means WNOHANG and the child is still running
+    result = proc_wait(pid, flags, &status);
+    if (result < 0) {
+        return ECHILD;
+    }
+    if (result > 0 && returncode != NULL) {
+        int err = copyout(&status, returncode, sizeof(status));
+        if (err) {
+            return err;
+        }
     }
 
-    return pid;
+    *retval = result;
+    return 0;
 #else 
     (void)pid;
     (void)returncode;
     (void)flags;
+    (void)retval;
 
-    return -1;
+    return ENOSYS;
 #endif
 }
 
@@ -36,6 +36,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/unistd.h>
 #include <lib.h>
 #include <proc.h>
 #include <current.h>
@@ -44,6 +45,9 @@
 #include <vfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <openfile.h>
+
+#include "opt-asst1.h"
 
 /*
  * Load program "progname" and start running it in usermode.
@@ -90,6 +94,17 @@ runprogram(char *progname)
 	/* Done with the file now. */
 	vfs_close(v);
 
+#if OPT_ASST1
+	/* Give the program a console to talk to. */
+	if (curproc->p_fds[STDIN_FILENO] == NULL) {
+		result = filetable_openconsole(curproc);
+		if (result) {
+			/* any that did open go when curproc is destroyed */
+			return result;
+		}
+	}
+#endif
+
 	/* Define the user stack in the address space */
 	result = as_define_stack(as, &stackptr);
 	if (result) {
@@ -0,0 +1,26 @@
+#include <types.h>
+#include <copyinout.h>
+#include <thread.h>
+#include <syscall.h>
+
+/*
+ * Restrict the calling thread to the cpus in MASK (bit N is cpu
+ * number N).
+ */
+int
+sys_sched_setaffinity(uint32_t mask)
+{
+	return thread_setaffinity(mask);
+}
+
+/*
+ * Get the calling thread's affinity mask.
+ */
+int
+sys_sched_getaffinity(userptr_t user_mask)
+{
+	uint32_t mask;
+
+	mask = thread_getaffinity();
+	return copyout(&mask, user_mask, sizeof(mask));
+}
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +57,40 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time in USER_REQ, rounded up to whole hardclocks.
+ * Nothing can interrupt the sleep in OS/161, so the remaining time
+ * (USER_REM) is never filled in.
+ */
+int
+sys_nanosleep(userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	unsigned ticks;
+	int result;
+
+	(void)user_rem;
+
+	result = copyin(user_req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	/* Very long sleeps just get clamped. */
+	if (ts.tv_sec >= 0x7fffffff / HZ - 1) {
+		ticks = 0x7fffffff;
+	}
+	else {
+		ticks = ts.tv_sec * HZ +
+			(ts.tv_nsec + 1000000000 / HZ - 1) / (1000000000 / HZ);
+	}
+
+	if (ticks > 0) {
+		ticksleep(ticks);
+	}
+	return 0;
+}
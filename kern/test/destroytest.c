@@ -0,0 +1,154 @@
+/*
+ * Destroy-after-use tests.
+ *
+ * It's common to destroy a semaphore as soon as the last P returns,
+ * or a lock as soon as the last holder is done with it, while the
+ * thread that did the V or the release may still be on its way out
+ * on another cpu. These do exactly that over and over, with the
+ * other thread pinned to a different cpu when there is one, so that
+ * V or lock_release touching the object after letting go of it
+ * shows up as an assertion or as a use of freed memory.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define NDESTROYLOOPS	500
+
+static struct semaphore *dt_startsem;
+
+/* Another cpu than ours, if there is one. */
+static
+unsigned long
+othercpu(void)
+{
+	unsigned n;
+
+	for (n=0; cpu_lookup(n) != NULL; n++) {
+		/* count them */
+	}
+	return (curcpu->c_number + 1) % n;
+}
+
+static
+void
+dtfork(void (*func)(void *, unsigned long), void *data)
+{
+	int result;
+
+	result = thread_fork("dt", NULL, func, data, othercpu());
+	if (result) {
+		panic("dt: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+static
+void
+pin(unsigned long cpunum)
+{
+	int result;
+
+	result = thread_setaffinity((uint32_t)1 << cpunum);
+	KASSERT(result == 0);
+}
+
+////////////////////////////////////////////////////////////
+// dt1: sem_destroy right after the last P
+
+static
+void
+vthread(void *data, unsigned long cpunum)
+{
+	struct semaphore *sem = data;
+
+	pin(cpunum);
+	V(dt_startsem);
+	/* nothing may touch SEM after this */
+	V(sem);
+}
+
+int
+destroytest1(int nargs, char **args)
+{
+	struct semaphore *sem;
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting dt1...\n");
+	dt_startsem = sem_create("dt_startsem", 0);
+	if (dt_startsem == NULL) {
+		panic("dt1: sem_create failed\n");
+	}
+	for (i=0; i<NDESTROYLOOPS; i++) {
+		sem = sem_create("dt1", 0);
+		if (sem == NULL) {
+			panic("dt1: sem_create failed\n");
+		}
+		dtfork(vthread, sem);
+		P(dt_startsem);
+		P(sem);
+		sem_destroy(sem);
+	}
+	sem_destroy(dt_startsem);
+	kprintf("dt1 passed.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// dt2: lock_destroy right after the last acquire
+
+static
+void
+holdthread(void *data, unsigned long cpunum)
+{
+	struct lock *lk = data;
+	unsigned i;
+
+	pin(cpunum);
+	lock_acquire(lk);
+	V(dt_startsem);
+	/* give the main thread time to start waiting */
+	for (i=0; i<10; i++) {
+		thread_yield();
+	}
+	/* nothing may touch LK after this */
+	lock_release(lk);
+}
+
+int
+destroytest2(int nargs, char **args)
+{
+	struct lock *lk;
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting dt2...\n");
+	dt_startsem = sem_create("dt_startsem", 0);
+	if (dt_startsem == NULL) {
+		panic("dt2: sem_create failed\n");
+	}
+	for (i=0; i<NDESTROYLOOPS; i++) {
+		lk = lock_create("dt2");
+		if (lk == NULL) {
+			panic("dt2: lock_create failed\n");
+		}
+		dtfork(holdthread, lk);
+		P(dt_startsem);
+		lock_acquire(lk);
+		lock_release(lk);
+		lock_destroy(lk);
+	}
+	sem_destroy(dt_startsem);
+	kprintf("dt2 passed.\n");
+	return 0;
+}
@@ -0,0 +1,214 @@
+/*
+ * RCU tests.
+ *
+ * rcut1: readers on every cpu keep following a published pointer
+ * while the main thread replaces it, waits with rcu_synchronize, and
+ * poisons the old object. A reader that still sees it after the
+ * grace period finds the poison. With more than one cpu, the last
+ * one instead runs a thread that never sleeps or yields, which
+ * mustn't hold grace periods up.
+ *
+ * rcut2: rcu_call runs its callback, in thread context, within a
+ * reasonable time.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <membar.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <rcu.h>
+#include <test.h>
+
+#define RCU_LIVE	0x1ee7
+#define RCU_DEAD	0xdead
+#define NRCUSWAPS	200
+#define NRCUSPINS	1000
+
+struct rcuobj {
+	volatile unsigned ro_magic;
+	struct rcu_head ro_rcu;
+};
+
+static struct rcuobj *volatile rcu_shared;
+static struct semaphore *rcudonesem;
+static volatile bool rcu_stop;
+
+static
+void
+rcusetup(void)
+{
+	rcudonesem = sem_create("rcudonesem", 0);
+	if (rcudonesem == NULL) {
+		panic("rcut: sem_create failed\n");
+	}
+	rcu_stop = false;
+}
+
+static
+struct rcuobj *
+rcuobj_create(void)
+{
+	struct rcuobj *ro;
+
+	ro = kmalloc(sizeof(*ro));
+	if (ro == NULL) {
+		panic("rcut: out of memory\n");
+	}
+	ro->ro_magic = RCU_LIVE;
+	return ro;
+}
+
+static
+void
+rcufork(void (*func)(void *, unsigned long), unsigned long cpunum)
+{
+	int result;
+
+	result = thread_fork("rcut", NULL, func, NULL, cpunum);
+	if (result) {
+		panic("rcut: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+static
+void
+rcupin(unsigned long cpunum)
+{
+	int result;
+
+	result = thread_setaffinity((uint32_t)1 << cpunum);
+	KASSERT(result == 0);
+}
+
+////////////////////////////////////////////////////////////
+// rcut1
+
+static
+void
+readerthread(void *junk, unsigned long cpunum)
+{
+	struct rcuobj *ro;
+	unsigned i;
+
+	(void)junk;
+	rcupin(cpunum);
+
+	while (!rcu_stop) {
+		rcu_read_lock();
+		ro = rcu_shared;
+		membar_load_load();
+		for (i=0; i<NRCUSPINS; i++) {
+			if (ro->ro_magic != RCU_LIVE) {
+				panic("rcut1: reader saw a freed object\n");
+			}
+		}
+		rcu_read_unlock();
+		thread_yield();
+	}
+	V(rcudonesem);
+}
+
+/*
+ * Never switches while the test runs, so only timer ticks can mark
+ * its cpu quiescent.
+ */
+static
+void
+hogthread(void *junk, unsigned long cpunum)
+{
+	(void)junk;
+	rcupin(cpunum);
+
+	while (!rcu_stop) {
+		/* spin */
+	}
+	V(rcudonesem);
+}
+
+int
+rcutest1(int nargs, char **args)
+{
+	struct rcuobj *old;
+	unsigned ncpus, i;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting rcut1...\n");
+	rcusetup();
+	rcu_shared = rcuobj_create();
+
+	/* a reader on each cpu but the last, which gets the hog */
+	for (ncpus=0; cpu_lookup(ncpus) != NULL; ncpus++) {
+		/* count them */
+	}
+	for (i=0; i<ncpus; i++) {
+		if (ncpus > 1 && i == ncpus - 1) {
+			rcufork(hogthread, i);
+		}
+		else {
+			rcufork(readerthread, i);
+		}
+	}
+
+	for (i=0; i<NRCUSWAPS; i++) {
+		old = rcu_shared;
+		membar_store_store();
+		rcu_shared = rcuobj_create();
+		rcu_synchronize();
+		old->ro_magic = RCU_DEAD;
+		kfree(old);
+	}
+
+	rcu_stop = true;
+	for (i=0; i<ncpus; i++) {
+		P(rcudonesem);
+	}
+	kfree(rcu_shared);
+	rcu_shared = NULL;
+	sem_destroy(rcudonesem);
+	kprintf("rcut1 passed.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// rcut2
+
+static
+void
+rcucallback(void *data)
+{
+	struct rcuobj *ro = data;
+
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(ro->ro_magic == RCU_LIVE);
+	ro->ro_magic = RCU_DEAD;
+	V(rcudonesem);
+}
+
+int
+rcutest2(int nargs, char **args)
+{
+	struct rcuobj *ro;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting rcut2...\n");
+	rcusetup();
+	ro = rcuobj_create();
+	rcu_call(&ro->ro_rcu, rcucallback, ro);
+	if (sem_timedP(rcudonesem, 5*HZ) == ETIMEDOUT) {
+		panic("rcut2: callback did not run\n");
+	}
+	KASSERT(ro->ro_magic == RCU_DEAD);
+	kfree(ro);
+	sem_destroy(rcudonesem);
+	kprintf("rcut2 passed.\n");
+	return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * Reader-writer lock tests.
+ *
+ * Like the semaphore unit tests, these look inside the rwlock to
+ * check its state and to wait for threads to block in it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define NRWTHREADS	16
+#define NRWLOOPS	40
+
+static struct rwlock *testrw;
+static struct semaphore *rwdonesem;
+
+static volatile unsigned long rwval1;
+static volatile unsigned long rwval2;
+
+static struct spinlock order_lock = SPINLOCK_INITIALIZER;
+static char order[8];
+static unsigned norder;
+
+static const char *const policynames[] = {
+	"reader preference", "writer preference", "", "fair",
+};
+
+static
+void
+rwsetup(unsigned flags)
+{
+	testrw = rwlock_create("rwtest", flags);
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	rwdonesem = sem_create("rwdonesem", 0);
+	if (rwdonesem == NULL) {
+		panic("rwtest: sem_create failed\n");
+	}
+}
+
+static
+void
+rwcleanup(void)
+{
+	rwlock_destroy(testrw);
+	sem_destroy(rwdonesem);
+}
+
+static
+void
+rwfork(const char *name, void (*func)(void *, unsigned long),
+       unsigned long num)
+{
+	int result;
+
+	result = thread_fork(name, NULL, func, NULL, num);
+	if (result) {
+		panic("rwtest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+/*
+ * Wait until READERS readers and WRITERS writers are blocked in the
+ * lock.
+ */
+static
+void
+rwwait(unsigned readers, unsigned writers)
+{
+	bool done;
+
+	do {
+		ticksleep(1);
+		spinlock_acquire(&testrw->rwlock_lock);
+		done = testrw->rwlock_rwaiting == readers &&
+			testrw->rwlock_wwaiting == writers;
+		spinlock_release(&testrw->rwlock_lock);
+	} while (!done);
+}
+
+////////////////////////////////////////////////////////////
+// rwt1: readers share the lock
+
+static
+void
+sharethread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_read(testrw);
+	V(rwdonesem);
+	rwlock_release_read(testrw);
+	V(rwdonesem);
+}
+
+int
+rwtest1(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting rwt1...\n");
+	rwsetup(0);
+
+	/* If the second reader can't get in, this times out. */
+	rwlock_acquire_read(testrw);
+	rwfork("rwt1", sharethread, 0);
+	if (sem_timedP(rwdonesem, HZ) == ETIMEDOUT) {
+		panic("rwt1: second reader did not get the lock\n");
+	}
+	rwlock_release_read(testrw);
+	P(rwdonesem);
+
+	rwcleanup();
+	kprintf("rwt1 passed.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// rwt2: stress, readers never see a writer or a half-done update
+
+static
+void
+stressthread(void *junk, unsigned long num)
+{
+	int i;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % 4 == 0) {
+			rwlock_acquire_write(testrw);
+			KASSERT(testrw->rwlock_readers == 0);
+			rwval1 = num + i;
+			thread_yield();
+			rwval2 = rwval1 * 2;
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+			KASSERT(testrw->rwlock_writer == NULL);
+			thread_yield();
+			if (rwval2 != rwval1 * 2) {
+				panic("rwt2: reader saw a partial update\n");
+			}
+			rwlock_release_read(testrw);
+		}
+	}
+	V(rwdonesem);
+}
+
+int
+rwtest2(int nargs, char **args)
+{
+	static const unsigned policies[] = {
+		0, RWLOCK_WRITERPREF, RWLOCK_FAIR,
+	};
+	unsigned p, i;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting rwt2...\n");
+	for (p=0; p<sizeof(policies)/sizeof(policies[0]); p++) {
+		kprintf("  %s\n", policynames[policies[p]]);
+		rwsetup(policies[p]);
+		rwval1 = rwval2 = 0;
+		for (i=0; i<NRWTHREADS; i++) {
+			rwfork("rwt2", stressthread, i);
+		}
+		for (i=0; i<NRWTHREADS; i++) {
+			P(rwdonesem);
+		}
+		rwcleanup();
+	}
+	kprintf("rwt2 passed.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// rwt3: policy ordering
+
+static
+void
+record(char c)
+{
+	spinlock_acquire(&order_lock);
+	KASSERT(norder < sizeof(order) - 1);
+	order[norder++] = c;
+	order[norder] = 0;
+	spinlock_release(&order_lock);
+}
+
+static
+void
+orderthread(void *junk, unsigned long writer)
+{
+	(void)junk;
+
+	if (writer) {
+		rwlock_acquire_write(testrw);
+		record('W');
+		rwlock_release_write(testrw);
+	}
+	else {
+		rwlock_acquire_read(testrw);
+		record('R');
+		rwlock_release_read(testrw);
+	}
+	V(rwdonesem);
+}
+
+/*
+ * Hold the lock for writing while a reader, a writer, and another
+ * reader queue up behind it, in that order, then let go and see who
+ * gets in when. (With reader preference the answer depends on who
+ * the scheduler runs first, so that policy isn't tested this way.)
+ */
+static
+void
+ordertest(unsigned flags, const char *expected)
+{
+	unsigned i;
+
+	rwsetup(flags);
+	norder = 0;
+	order[0] = 0;
+
+	rwlock_acquire_write(testrw);
+	rwfork("rwt3", orderthread, 0);
+	rwwait(1, 0);
+	rwfork("rwt3", orderthread, 1);
+	rwwait(1, 1);
+	rwfork("rwt3", orderthread, 0);
+	rwwait(2, 1);
+	rwlock_release_write(testrw);
+
+	for (i=0; i<3; i++) {
+		P(rwdonesem);
+	}
+	rwcleanup();
+
+	kprintf("  %s: %s\n", policynames[flags], order);
+	if (strcmp(order, expected)) {
+		panic("rwt3: expected %s\n", expected);
+	}
+}
+
+int
+rwtest3(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting rwt3...\n");
+
+	/*
+	 * With reader preference a new reader gets in past a waiting
+	 * writer; with writer preference it has to wait.
+	 */
+	rwsetup(0);
+	rwlock_acquire_read(testrw);
+	rwfork("rwt3", orderthread, 1);
+	rwwait(0, 1);
+	rwfork("rwt3", sharethread, 0);
+	if (sem_timedP(rwdonesem, HZ) == ETIMEDOUT) {
+		panic("rwt3: reader did not get past a waiting writer\n");
+	}
+	rwlock_release_read(testrw);
+	P(rwdonesem);
+	P(rwdonesem);
+	rwcleanup();
+	kprintf("  %s: ok\n", policynames[0]);
+
+	rwsetup(RWLOCK_WRITERPREF);
+	rwlock_acquire_read(testrw);
+	rwfork("rwt3", orderthread, 1);
+	rwwait(0, 1);
+	rwfork("rwt3", orderthread, 0);
+	rwwait(1, 1);
+	rwlock_release_read(testrw);
+	P(rwdonesem);
+	P(rwdonesem);
+	rwcleanup();
+	kprintf("  %s: ok\n", policynames[RWLOCK_WRITERPREF]);
+
+	/* Who goes first when a writer lets go. */
+	ordertest(RWLOCK_WRITERPREF, "WRR");
+	ordertest(RWLOCK_FAIR, "RRW");
+
+	kprintf("rwt3 passed.\n");
+	return 0;
+}
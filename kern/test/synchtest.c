@@ -32,6 +32,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
@@ -220,6 +221,91 @@ locktest(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Lock contention microbenchmark: a few threads take turns at a
+ * lock with a tiny critical section, as most real kernel locks have.
+ * With more than one cpu this shows how much spinning on a running
+ * owner saves over sleeping.
+ */
+#define NLOCKBENCH	10000
+#define NBENCHTHREADS	4
+
+static struct barrier *startbarrier;
+static struct latch *donelatch;
+
+static
+void
+lockbenchthread(void *junk, unsigned long n)
+{
+	unsigned long i;
+	(void)junk;
+
+	barrier_wait(startbarrier);
+	for (i=0; i<n; i++) {
+		lock_acquire(testlock);
+		testval1++;
+		lock_release(testlock);
+	}
+	latch_countdown(donelatch);
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	struct timespec before, after;
+	unsigned long usec;
+	int i, n, result;
+
+	n = (nargs > 1) ? atoi(args[1]) : NLOCKBENCH;
+	if (n <= 0) {
+		kprintf("Usage: sy5 [count]\n");
+		return EINVAL;
+	}
+
+	inititems();
+	testval1 = 0;
+	startbarrier = barrier_create("lockbench", NBENCHTHREADS + 1);
+	donelatch = latch_create("lockbench", NBENCHTHREADS);
+	if (startbarrier == NULL || donelatch == NULL) {
+		panic("lockbench: out of memory\n");
+	}
+	kprintf("Starting lock benchmark...\n");
+
+	/* Don't count the forks; time from when everyone's ready. */
+	for (i=0; i<NBENCHTHREADS; i++) {
+		result = thread_fork("lockbench", NULL, lockbenchthread,
+				     NULL, n);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	barrier_wait(startbarrier);
+	gettime(&before);
+	latch_wait(donelatch);
+	gettime(&after);
+
+	barrier_destroy(startbarrier);
+	latch_destroy(donelatch);
+
+	if (testval1 != (unsigned long)n * NBENCHTHREADS) {
+		panic("lockbench: count is %lu, expected %lu\n", testval1,
+		      (unsigned long)n * NBENCHTHREADS);
+	}
+
+	/* after -= before */
+	timespec_sub(&after, &before, &after);
+	usec = after.tv_sec * 1000000UL + after.tv_nsec / 1000;
+
+	kprintf("%lu lock round trips in %llu.%09lu seconds (%llu ns each)\n",
+		testval1, (unsigned long long)after.tv_sec,
+		(unsigned long)after.tv_nsec,
+		(unsigned long long)usec * 1000 / testval1);
+	kprintf("Lock benchmark done.\n");
+
+	return 0;
+}
+
 static
 void
 cvtestthread(void *junk, unsigned long num)
@@ -399,3 +485,89 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+/*
+ * Barrier test. Each thread adds one to a counter and waits at the
+ * barrier, over and over. Nobody can get more than one round ahead,
+ * so after round N everyone must see the counter between N rounds'
+ * and N+1 rounds' worth, and exactly one thread per round gets true
+ * back from barrier_wait.
+ */
+
+#define NBARRIERLOOPS	20
+
+static struct barrier *testbarrier;
+static struct spinlock barrier_count_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned barrier_count;
+static volatile unsigned barrier_serial;
+
+static
+void
+barrierthread(void *junk, unsigned long num)
+{
+	unsigned i, count;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NBARRIERLOOPS; i++) {
+		spinlock_acquire(&barrier_count_lock);
+		barrier_count++;
+		spinlock_release(&barrier_count_lock);
+
+		if (barrier_wait(testbarrier)) {
+			spinlock_acquire(&barrier_count_lock);
+			barrier_serial++;
+			spinlock_release(&barrier_count_lock);
+		}
+
+		count = barrier_count;
+		if (count < (i+1) * NTHREADS || count > (i+2) * NTHREADS) {
+			panic("barriertest: round %u: count %u\n", i, count);
+		}
+	}
+	latch_countdown(donelatch);
+}
+
+int
+barriertest(int nargs, char **args)
+{
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting barrier test...\n");
+
+	testbarrier = barrier_create("barriertest", NTHREADS);
+	donelatch = latch_create("barriertest", NTHREADS);
+	if (testbarrier == NULL || donelatch == NULL) {
+		panic("barriertest: out of memory\n");
+	}
+	barrier_count = 0;
+	barrier_serial = 0;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("barriertest", NULL, barrierthread,
+				     NULL, i);
+		if (result) {
+			panic("barriertest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	latch_wait(donelatch);
+
+	if (barrier_serial != NBARRIERLOOPS) {
+		panic("barriertest: %u serial threads in %u rounds\n",
+		      barrier_serial, NBARRIERLOOPS);
+	}
+
+	barrier_destroy(testbarrier);
+	latch_destroy(donelatch);
+	testbarrier = NULL;
+	donelatch = NULL;
+
+	kprintf("Barrier test done.\n");
+	return 0;
+}
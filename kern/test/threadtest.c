@@ -31,12 +31,15 @@
  * Thread test code.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
 
 #define NTHREADS  8
+#define NFORKS    1000
 
 static struct semaphore *tsem = NULL;
 
@@ -144,3 +147,57 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+static
+void
+nullthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(tsem);
+}
+
+/*
+ * Fork/exit microbenchmark: fork threads that exit immediately, one
+ * at a time, and report how long it took. This mostly measures the
+ * cost of thread creation and destruction.
+ */
+int
+threadtest4(int nargs, char **args)
+{
+	struct timespec before, after;
+	unsigned long usec;
+	int i, n, result;
+
+	n = (nargs > 1) ? atoi(args[1]) : NFORKS;
+	if (n <= 0) {
+		kprintf("Usage: tt4 [count]\n");
+		return EINVAL;
+	}
+
+	init_sem();
+	kprintf("Starting thread fork/exit benchmark...\n");
+
+	gettime(&before);
+	for (i=0; i<n; i++) {
+		result = thread_fork("forkbench", NULL, nullthread, NULL, i);
+		if (result) {
+			panic("threadtest4: thread_fork failed %s)\n",
+			      strerror(result));
+		}
+		P(tsem);
+	}
+	gettime(&after);
+
+	/* after -= before */
+	timespec_sub(&after, &before, &after);
+	usec = after.tv_sec * 1000000UL + after.tv_nsec / 1000;
+
+	kprintf("%d forks in %llu.%09lu seconds (%lu us each)\n", n,
+		(unsigned long long)after.tv_sec,
+		(unsigned long)after.tv_nsec, usec / n);
+	kprintf("Thread fork/exit benchmark done.\n");
+
+	return 0;
+}
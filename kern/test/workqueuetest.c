@@ -0,0 +1,173 @@
+/*
+ * Workqueue tests.
+ *
+ * wqt1 has a work item queue itself again from its own function
+ * until it has run enough times. wqt2 has a thread on every cpu try
+ * to queue the same item at once; each successful work_queue must
+ * lead to exactly one run, or the item got onto two queues.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define NREQUEUES	100
+#define NQUEUETRIES	2000
+
+static struct work testwork;
+static struct semaphore *wqdonesem;
+static struct spinlock wqcount_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned wqqueued, wqran;
+static volatile bool wqgo;
+
+static
+void
+wqsetup(void (*func)(void *))
+{
+	work_init(&testwork, func, NULL);
+	wqdonesem = sem_create("wqdonesem", 0);
+	if (wqdonesem == NULL) {
+		panic("wqt: sem_create failed\n");
+	}
+	wqqueued = wqran = 0;
+}
+
+static
+unsigned
+wqcount(volatile unsigned *counter)
+{
+	unsigned ret;
+
+	spinlock_acquire(&wqcount_lock);
+	ret = *counter;
+	spinlock_release(&wqcount_lock);
+	return ret;
+}
+
+static
+void
+wqbump(volatile unsigned *counter)
+{
+	spinlock_acquire(&wqcount_lock);
+	(*counter)++;
+	spinlock_release(&wqcount_lock);
+}
+
+////////////////////////////////////////////////////////////
+// wqt1: requeue from inside the work function
+
+static
+void
+requeuework(void *junk)
+{
+	(void)junk;
+
+	wqbump(&wqran);
+	if (wqcount(&wqran) < NREQUEUES) {
+		if (!work_queue(&testwork)) {
+			panic("wqt1: item still marked queued in its function\n");
+		}
+		return;
+	}
+	V(wqdonesem);
+}
+
+int
+workqueuetest1(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting wqt1...\n");
+	wqsetup(requeuework);
+	if (!work_queue(&testwork)) {
+		panic("wqt1: fresh item already queued\n");
+	}
+	if (sem_timedP(wqdonesem, 5*HZ) == ETIMEDOUT) {
+		panic("wqt1: ran %u times of %u\n", wqcount(&wqran),
+		      NREQUEUES);
+	}
+	sem_destroy(wqdonesem);
+	kprintf("wqt1 passed.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// wqt2: queue one item from every cpu at once
+
+static
+void
+countwork(void *junk)
+{
+	(void)junk;
+	wqbump(&wqran);
+}
+
+static
+void
+queuethread(void *junk, unsigned long cpunum)
+{
+	unsigned i;
+	int result;
+
+	(void)junk;
+
+	result = thread_setaffinity((uint32_t)1 << cpunum);
+	KASSERT(result == 0);
+
+	while (!wqgo) {
+		/* spin, so everyone starts together */
+	}
+	for (i=0; i<NQUEUETRIES; i++) {
+		if (work_queue(&testwork)) {
+			wqbump(&wqqueued);
+		}
+	}
+	V(wqdonesem);
+}
+
+int
+workqueuetest2(int nargs, char **args)
+{
+	unsigned ncpus, i, tries;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting wqt2...\n");
+	wqsetup(countwork);
+	wqgo = false;
+
+	for (ncpus=0; cpu_lookup(ncpus) != NULL; ncpus++) {
+		result = thread_fork("wqt2", NULL, queuethread, NULL, ncpus);
+		if (result) {
+			panic("wqt2: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	wqgo = true;
+	for (i=0; i<ncpus; i++) {
+		P(wqdonesem);
+	}
+
+	/* Let the workers catch up; runs can only lag queues. */
+	for (tries=0; wqcount(&wqran) != wqcount(&wqqueued); tries++) {
+		if (tries == 5*HZ || wqcount(&wqran) > wqcount(&wqqueued)) {
+			panic("wqt2: queued %u times but ran %u\n",
+			      wqcount(&wqqueued), wqcount(&wqran));
+		}
+		ticksleep(1);
+	}
+
+	sem_destroy(wqdonesem);
+	kprintf("wqt2 passed (%u cpus, %u runs).\n", ncpus, wqcount(&wqran));
+	return 0;
+}
@@ -34,13 +34,15 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <spl.h>
+#include <mainbus.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * This is pretty primitive. Besides the once-a-second lbolt, there
+ * is a timer wheel on each cpu for calling functions at some number
+ * of hardclock ticks in the future; timed sleeps are built on that.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -50,8 +52,8 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	HZ	/* Boost priorities once a second. */
+#define IDLE_MAXHARDCLOCKS	(10*HZ)	/* Longest tickless idle stretch. */
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
@@ -59,6 +61,13 @@
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+/*
+ * Threads in ticksleep() wait here. Nobody wakes this channel; each
+ * sleeper is woken by its own timeout.
+ */
+static struct wchan *ticksleep_wchan;
+static struct spinlock ticksleep_lock;
+
 /*
  * Setup.
  */
@@ -70,6 +79,165 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	spinlock_init(&ticksleep_lock);
+	ticksleep_wchan = wchan_create("ticksleep");
+	if (ticksleep_wchan == NULL) {
+		panic("Couldn't create ticksleep channel\n");
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Timers.
+
+/*
+ * Initialize a cpu's timer wheel.
+ */
+void
+timerwheel_init(struct timerwheel *tw)
+{
+	unsigned i;
+
+	spinlock_init(&tw->tw_lock);
+	for (i=0; i<TIMERWHEEL_SLOTS; i++) {
+		tw->tw_slots[i] = NULL;
+	}
+	tw->tw_running = NULL;
+}
+
+/*
+ * Take a pending timer off its wheel. The wheel must be locked.
+ */
+static
+void
+timer_unlink(struct timer *tm)
+{
+	*tm->tm_pprev = tm->tm_next;
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_pprev = tm->tm_pprev;
+	}
+	tm->tm_next = NULL;
+	tm->tm_pprev = NULL;
+}
+
+void
+timer_init(struct timer *tm, void (*func)(void *), void *data)
+{
+	tm->tm_next = NULL;
+	tm->tm_pprev = NULL;
+	tm->tm_cpu = NULL;
+	tm->tm_expires = 0;
+	tm->tm_func = func;
+	tm->tm_data = data;
+}
+
+void
+timer_start(struct timer *tm, unsigned ticks)
+{
+	struct timerwheel *tw;
+	struct timer **slot;
+	int spl;
+
+	KASSERT(tm->tm_pprev == NULL);
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	/* Keep the expiry time comparable with signed arithmetic. */
+	if (ticks > 0x7fffffff) {
+		ticks = 0x7fffffff;
+	}
+
+	/* Stay on this cpu while looking at its wheel and clock. */
+	spl = splhigh();
+	tw = &curcpu->c_timers;
+
+	spinlock_acquire(&tw->tw_lock);
+	tm->tm_cpu = curcpu->c_self;
+	tm->tm_expires = curcpu->c_hardclocks + ticks;
+	slot = &tw->tw_slots[tm->tm_expires % TIMERWHEEL_SLOTS];
+	tm->tm_next = *slot;
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_pprev = &tm->tm_next;
+	}
+	tm->tm_pprev = slot;
+	*slot = tm;
+	spinlock_release(&tw->tw_lock);
+
+	splx(spl);
+}
+
+bool
+timer_stop(struct timer *tm)
+{
+	struct timerwheel *tw;
+	bool pending;
+
+	if (tm->tm_cpu == NULL) {
+		/* Never started. */
+		return false;
+	}
+	tw = &tm->tm_cpu->c_timers;
+
+	spinlock_acquire(&tw->tw_lock);
+	pending = tm->tm_pprev != NULL;
+	if (pending) {
+		timer_unlink(tm);
+	}
+	spinlock_release(&tw->tw_lock);
+
+	/*
+	 * If it's going off right now, wait until it's done. This
+	 * can only be happening on another cpu: on our own, the
+	 * function runs in an interrupt handler, so we can't be
+	 * here at the same time.
+	 */
+	while (tw->tw_running == tm) {
+		/* spin */
+	}
+
+	return pending;
+}
+
+/*
+ * Run the timers on the current cpu that are due. The wheel lock is
+ * dropped while calling each function, so the functions can take
+ * other locks and start or stop timers.
+ */
+static
+void
+timerwheel_run(void)
+{
+	struct timerwheel *tw;
+	struct timer **slot, *tm;
+	unsigned now;
+
+	tw = &curcpu->c_timers;
+	now = curcpu->c_hardclocks;
+	slot = &tw->tw_slots[now % TIMERWHEEL_SLOTS];
+
+	spinlock_acquire(&tw->tw_lock);
+	tm = *slot;
+	while (tm != NULL) {
+		/* Timers in this slot for later times around the wheel */
+		if ((int)(tm->tm_expires - now) > 0) {
+			tm = tm->tm_next;
+			continue;
+		}
+
+		timer_unlink(tm);
+		tw->tw_running = tm;
+		spinlock_release(&tw->tw_lock);
+
+		tm->tm_func(tm->tm_data);
+
+		spinlock_acquire(&tw->tw_lock);
+		tw->tw_running = NULL;
+
+		/* The slot may have changed meanwhile; start over. */
+		tm = *slot;
+	}
+	spinlock_release(&tw->tw_lock);
 }
 
 /*
@@ -86,24 +254,106 @@ timerclock(void)
 }
 
 /*
- * This is called HZ times a second (on each processor) by the timer
- * code.
+ * Account for one tick on the current cpu.
  */
+static
 void
-hardclock(void)
+hardclock_tick(void)
 {
 	/*
 	 * Collect statistics here as desired.
 	 */
 
 	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
-	}
+	timerwheel_run();
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+}
+
+/*
+ * This is called HZ times a second (on each processor) by the timer
+ * code, except while the processor is idle.
+ */
+void
+hardclock(void)
+{
+	unsigned skipped;
+
+	/* If the timer was stretched while idle, catch up first. */
+	if (curcpu->c_tickless > 0) {
+		skipped = curcpu->c_tickless - 1;
+		curcpu->c_tickless = 0;
+		while (skipped-- > 0) {
+			hardclock_tick();
+		}
+	}
+
+	hardclock_tick();
+	thread_timeslice();
+}
+
+/*
+ * Tickless idle.
+ *
+ * An idle cpu has nothing to do on most hardclocks, and taking HZ
+ * interrupts a second anyway wastes host time under System/161 and
+ * disturbs the other cpus sharing the bus. So before idling we
+ * stretch the timer out to the next timer due on this cpu's wheel,
+ * and whatever interrupt ends the idle period, the skipped ticks are
+ * run afterwards, in hardclock() or in hardclock_unidle(). Work
+ * arriving from other cpus unidles us with an IPI.
+ *
+ * Timers only get added to a cpu's wheel by that cpu, so nothing can
+ * become due earlier while it sleeps, other than from an interrupt
+ * that wakes it anyway.
+ */
+void
+hardclock_idle(void)
+{
+	struct timerwheel *tw;
+	struct timer *tm;
+	unsigned i, now, ticks;
+
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(curcpu->c_tickless == 0);
+
+	tw = &curcpu->c_timers;
+	now = curcpu->c_hardclocks;
+	ticks = IDLE_MAXHARDCLOCKS;
+
+	spinlock_acquire(&tw->tw_lock);
+	for (i=0; i<TIMERWHEEL_SLOTS && ticks > 1; i++) {
+		for (tm = tw->tw_slots[i]; tm != NULL; tm = tm->tm_next) {
+			if ((int)(tm->tm_expires - now) < (int)ticks) {
+				ticks = tm->tm_expires - now;
+			}
+		}
+	}
+	spinlock_release(&tw->tw_lock);
+
+	if ((int)ticks > 1 && mainbus_timer_stretch(ticks)) {
+		curcpu->c_tickless = ticks;
+	}
+}
+
+void
+hardclock_unidle(void)
+{
+	unsigned ticks;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	/* Nothing to do if the timer interrupt already caught us up. */
+	if (curcpu->c_tickless == 0) {
+		return;
+	}
+
+	ticks = mainbus_timer_resume(curcpu->c_tickless);
+	curcpu->c_tickless = 0;
+	while (ticks-- > 0) {
+		hardclock_tick();
+	}
 }
 
 /*
@@ -119,3 +369,17 @@ clocksleep(int num_secs)
 	}
 	spinlock_release(&lbolt_lock);
 }
+
+/*
+ * Suspend execution for TICKS hardclocks.
+ *
+ * Since the current tick is already partly over, we wait for one
+ * more tick boundary than asked, so the sleep is never short.
+ */
+void
+ticksleep(unsigned ticks)
+{
+	spinlock_acquire(&ticksleep_lock);
+	(void)wchan_timedsleep(ticksleep_wchan, &ticksleep_lock, ticks + 1);
+	spinlock_release(&ticksleep_lock);
+}
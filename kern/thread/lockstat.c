@@ -0,0 +1,274 @@
+/*
+ * Lock contention statistics. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <mainbus.h>
+#include <lockstat.h>
+
+/* Longest lock name we tell apart; longer ones are truncated. */
+#define LOCKSTAT_NAMELEN 24
+/* Number of distinct locks each cpu can track. */
+#define LOCKSTAT_NENTRIES 64
+
+struct lockstat {
+	char ls_name[LOCKSTAT_NAMELEN];	/* sleep lock name, or "" */
+	vaddr_t ls_site;		/* spinlock acquire site, or 0 */
+	unsigned ls_acquires;		/* number of acquires */
+	unsigned ls_contended;		/* acquires that had to wait */
+	uint64_t ls_spins;		/* polls of the lock while waiting */
+	uint64_t ls_waitcycles;		/* total time spent waiting */
+	uint64_t ls_holdcycles;		/* total time held */
+};
+
+struct lockstat_table {
+	unsigned lt_generation;		/* lockstat_generation when cleared */
+	unsigned lt_dropped;		/* events we had no room for */
+	struct lockstat lt_entries[LOCKSTAT_NENTRIES];
+};
+
+/* Bumped by lockstat_reset; tables from older generations are stale. */
+static volatile unsigned lockstat_generation;
+
+struct lockstat_table *
+lockstat_create(void)
+{
+	struct lockstat_table *lt;
+
+	lt = kmalloc(sizeof(*lt));
+	if (lt == NULL) {
+		return NULL;
+	}
+	bzero(lt, sizeof(*lt));
+	lt->lt_generation = lockstat_generation;
+	return lt;
+}
+
+/*
+ * Hash a lock name or an acquire site.
+ */
+static
+unsigned
+lockstat_hash(const char *name, vaddr_t site)
+{
+	unsigned h;
+
+	if (name == NULL) {
+		return (site >> 2) * 2654435761U;
+	}
+	h = 0;
+	while (*name != 0) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+/*
+ * Find or claim the current cpu's entry for a lock. Interrupts must
+ * be off. Returns NULL if the table is missing or full.
+ */
+static
+struct lockstat *
+lockstat_lookup(const char *name, vaddr_t site)
+{
+	struct lockstat_table *lt;
+	struct lockstat *ls;
+	char key[LOCKSTAT_NAMELEN];
+	unsigned h, i;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	lt = curcpu->c_lockstat;
+	if (lt == NULL) {
+		return NULL;
+	}
+	if (lt->lt_generation != lockstat_generation) {
+		bzero(lt, sizeof(*lt));
+		lt->lt_generation = lockstat_generation;
+	}
+	if (name != NULL) {
+		if (*name == 0) {
+			name = "(unnamed)";
+		}
+		for (i=0; i<LOCKSTAT_NAMELEN - 1 && name[i] != 0; i++) {
+			key[i] = name[i];
+		}
+		key[i] = 0;
+		name = key;
+	}
+
+	h = lockstat_hash(name, site);
+	for (i=0; i<LOCKSTAT_NENTRIES; i++) {
+		ls = &lt->lt_entries[(h + i) % LOCKSTAT_NENTRIES];
+		if (name != NULL) {
+			if (!strcmp(ls->ls_name, name)) {
+				return ls;
+			}
+		}
+		else if (ls->ls_site == site) {
+			return ls;
+		}
+		if (ls->ls_name[0] == 0 && ls->ls_site == 0) {
+			if (name != NULL) {
+				strcpy(ls->ls_name, name);
+			}
+			else {
+				ls->ls_site = site;
+			}
+			return ls;
+		}
+	}
+	lt->lt_dropped++;
+	return NULL;
+}
+
+void
+lockstat_acquired(const char *name, vaddr_t site, bool contended,
+		  unsigned spins, uint64_t waitcycles)
+{
+	struct lockstat *ls;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+
+	spl = splhigh();
+	ls = lockstat_lookup(name, site);
+	if (ls != NULL) {
+		ls->ls_acquires++;
+		if (contended) {
+			ls->ls_contended++;
+			ls->ls_spins += spins;
+			ls->ls_waitcycles += waitcycles;
+		}
+	}
+	splx(spl);
+}
+
+void
+lockstat_released(const char *name, vaddr_t site, uint64_t holdcycles)
+{
+	struct lockstat *ls;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+
+	spl = splhigh();
+	ls = lockstat_lookup(name, site);
+	if (ls != NULL) {
+		ls->ls_holdcycles += holdcycles;
+	}
+	splx(spl);
+}
+
+/*
+ * Add up all the cpus' tables and print the result, most waited-for
+ * locks first. The other cpus keep updating their tables while we
+ * read them, so the numbers can be slightly inconsistent.
+ */
+void
+lockstat_dump(void)
+{
+	struct lockstat *all, *ls, *best;
+	struct lockstat_table *lt;
+	struct cpu *c;
+	unsigned ncpus, nall, dropped, gen;
+	unsigned i, j;
+
+	for (ncpus = 0; cpu_lookup(ncpus) != NULL; ncpus++) {
+		/* nothing */
+	}
+
+	all = kmalloc(ncpus * LOCKSTAT_NENTRIES * sizeof(*all));
+	if (all == NULL) {
+		kprintf("lockstat: Out of memory\n");
+		return;
+	}
+
+	gen = lockstat_generation;
+	nall = 0;
+	dropped = 0;
+	for (i=0; i<ncpus; i++) {
+		c = cpu_lookup(i);
+		lt = c->c_lockstat;
+		if (lt == NULL || lt->lt_generation != gen) {
+			continue;
+		}
+		dropped += lt->lt_dropped;
+		for (j=0; j<LOCKSTAT_NENTRIES; j++) {
+			ls = &lt->lt_entries[j];
+			if (ls->ls_name[0] == 0 && ls->ls_site == 0) {
+				continue;
+			}
+			for (best = all; best < all + nall; best++) {
+				if (best->ls_site == ls->ls_site &&
+				    !strcmp(best->ls_name, ls->ls_name)) {
+					break;
+				}
+			}
+			if (best == all + nall) {
+				*best = *ls;
+				nall++;
+				continue;
+			}
+			best->ls_acquires += ls->ls_acquires;
+			best->ls_contended += ls->ls_contended;
+			best->ls_spins += ls->ls_spins;
+			best->ls_waitcycles += ls->ls_waitcycles;
+			best->ls_holdcycles += ls->ls_holdcycles;
+		}
+	}
+
+	kprintf("Lock statistics (%u events dropped):\n", dropped);
+	kprintf("  %-23s %9s %8s %10s %12s %12s\n",
+		"lock", "acquires", "waited", "spins", "wait cyc", "hold cyc");
+
+	/* Selection sort by wait time; mark printed entries by acquires=0. */
+	while (1) {
+		best = NULL;
+		for (ls = all; ls < all + nall; ls++) {
+			if (ls->ls_acquires == 0 && ls->ls_holdcycles == 0) {
+				continue;
+			}
+			if (best == NULL ||
+			    ls->ls_waitcycles > best->ls_waitcycles ||
+			    (ls->ls_waitcycles == best->ls_waitcycles &&
+			     ls->ls_acquires > best->ls_acquires)) {
+				best = ls;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+
+		if (best->ls_name[0] != 0) {
+			kprintf("  %-23s", best->ls_name);
+		}
+		else {
+			kprintf("  spinlock@0x%08lx     ",
+				(unsigned long)best->ls_site);
+		}
+		kprintf(" %9u %8u %10llu %12llu %12llu\n",
+			best->ls_acquires, best->ls_contended,
+			(unsigned long long)best->ls_spins,
+			(unsigned long long)best->ls_waitcycles,
+			(unsigned long long)best->ls_holdcycles);
+		best->ls_acquires = 0;
+		best->ls_holdcycles = 0;
+	}
+
+	kfree(all);
+}
+
+void
+lockstat_reset(void)
+{
+	lockstat_generation++;
+}
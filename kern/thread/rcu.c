@@ -0,0 +1,154 @@
+/*
+ * Read-copy-update style reclamation. See rcu.h.
+ *
+ * There is a global epoch counter. Each grace period starts by
+ * bumping it, and each cpu copies it into c_rcu_epoch at every
+ * quiescent state: a thread switch, or a timer tick that finds the
+ * running thread outside any read section. Once every cpu that isn't
+ * idle has a copy at least as new as the epoch a grace period started
+ * with, no reader from before it is left.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+#include <rcu.h>
+
+static volatile unsigned rcu_epoch;
+
+/* Callbacks waiting for a grace period, and the work item to run them. */
+static struct spinlock rcu_lock = SPINLOCK_INITIALIZER;
+static struct rcu_head *rcu_head;
+static struct rcu_head *rcu_tail;
+static struct work rcu_work;
+
+static void rcu_callbacks(void *junk);
+
+void
+rcu_bootstrap(void)
+{
+	rcu_epoch = 0;
+	rcu_head = rcu_tail = NULL;
+	work_init(&rcu_work, rcu_callbacks, NULL);
+}
+
+void
+rcu_read_lock(void)
+{
+	curthread->t_rcu_nest++;
+}
+
+void
+rcu_read_unlock(void)
+{
+	KASSERT(curthread->t_rcu_nest > 0);
+	curthread->t_rcu_nest--;
+}
+
+void
+rcu_quiescent(void)
+{
+	/* All our reads are done before the epoch is seen to move. */
+	membar_any_any();
+	curcpu->c_rcu_epoch = rcu_epoch;
+}
+
+/*
+ * Check if the grace period that started at EPOCH is over. This looks
+ * at other cpus' c_isidle without their run queue locks; a cpu that
+ * stops being idle right after we look can only start readers that
+ * will never see what was unpublished before EPOCH.
+ */
+static
+bool
+rcu_grace_over(unsigned epoch)
+{
+	struct cpu *c;
+	unsigned i;
+
+	membar_any_any();
+	for (i=0; (c = cpu_lookup(i)) != NULL; i++) {
+		if (!c->c_isidle && (int)(c->c_rcu_epoch - epoch) < 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void
+rcu_synchronize(void)
+{
+	unsigned epoch;
+
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(curthread->t_rcu_nest == 0);
+
+	spinlock_acquire(&rcu_lock);
+	epoch = ++rcu_epoch;
+	spinlock_release(&rcu_lock);
+
+	/*
+	 * Every busy cpu passes a quiescent state within a tick or so
+	 * of its reader finishing, so this doesn't take long. Sleeping
+	 * takes care of our own cpu.
+	 */
+	while (!rcu_grace_over(epoch)) {
+		ticksleep(1);
+	}
+}
+
+void
+rcu_call(struct rcu_head *head, void (*func)(void *), void *data)
+{
+	head->rh_next = NULL;
+	head->rh_func = func;
+	head->rh_data = data;
+
+	spinlock_acquire(&rcu_lock);
+	if (rcu_tail == NULL) {
+		rcu_head = head;
+	}
+	else {
+		rcu_tail->rh_next = head;
+	}
+	rcu_tail = head;
+	spinlock_release(&rcu_lock);
+
+	work_queue(&rcu_work);
+}
+
+/*
+ * Work function: take everything queued so far, wait out a grace
+ * period, and call it all. Anything queued meanwhile requeues the
+ * work and waits for the next round.
+ */
+static
+void
+rcu_callbacks(void *junk)
+{
+	struct rcu_head *head, *next;
+
+	(void)junk;
+
+	spinlock_acquire(&rcu_lock);
+	head = rcu_head;
+	rcu_head = rcu_tail = NULL;
+	spinlock_release(&rcu_lock);
+
+	if (head == NULL) {
+		return;
+	}
+
+	rcu_synchronize();
+
+	for (; head != NULL; head = next) {
+		next = head->rh_next;
+		head->rh_func(head->rh_data);
+	}
+}
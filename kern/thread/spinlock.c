@@ -38,6 +38,8 @@
 #include <spinlock.h>
 #include <membar.h>
 #include <current.h>	/* for curcpu */
+#include <mainbus.h>
+#include <lockstat.h>
 
 /*
  * Spinlocks.
@@ -50,9 +52,18 @@
 void
 spinlock_init(struct spinlock *splk)
 {
+#if OPT_TICKET_SPINLOCK
+	spinlock_data_set(&splk->splk_next, 0);
+	spinlock_data_set(&splk->splk_serving, 0);
+#else
 	spinlock_data_set(&splk->splk_lock, 0);
+#endif
 	splk->splk_holder = NULL;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
+#if OPT_LOCKSTAT
+	splk->splk_site = 0;
+	splk->splk_since = 0;
+#endif
 }
 
 /*
@@ -62,7 +73,12 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
+#if OPT_TICKET_SPINLOCK
+	KASSERT(spinlock_data_get(&splk->splk_next) ==
+		spinlock_data_get(&splk->splk_serving));
+#else
 	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+#endif
 }
 
 /*
@@ -71,11 +87,23 @@ spinlock_cleanup(struct spinlock *splk)
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
  * atomic operation to wait for the lock to be free.
+ *
+ * With ticket spinlocks, each cpu takes a ticket and waits for its
+ * number to come up, so the lock is handed out in FIFO order and the
+ * waiters only read the lock while spinning. Otherwise whichever cpu
+ * wins the test-and-set gets it.
  */
 void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+#if OPT_TICKET_SPINLOCK
+	spinlock_data_t ticket;
+#endif
+#if OPT_LOCKSTAT
+	uint64_t start = 0;
+	unsigned spins = 0;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -93,6 +121,20 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
+#if OPT_LOCKSTAT
+	if (mycpu != NULL) {
+		start = mainbus_cycles();
+	}
+#endif
+
+#if OPT_TICKET_SPINLOCK
+	ticket = spinlock_data_fetchinc(&splk->splk_next);
+	while (spinlock_data_get(&splk->splk_serving) != ticket) {
+#if OPT_LOCKSTAT
+		spins++;
+#endif
+	}
+#else
 	while (1) {
 		/*
 		 * Do test-test-and-set, that is, read first before
@@ -105,17 +147,33 @@ spinlock_acquire(struct spinlock *splk)
 		 * we don't.
 		 */
 		if (spinlock_data_get(&splk->splk_lock) != 0) {
+#if OPT_LOCKSTAT
+			spins++;
+#endif
 			continue;
 		}
 		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+#if OPT_LOCKSTAT
+			spins++;
+#endif
 			continue;
 		}
 		break;
 	}
+#endif
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
 
+#if OPT_LOCKSTAT
+	if (mycpu != NULL) {
+		splk->splk_site = (vaddr_t)__builtin_return_address(0);
+		splk->splk_since = mainbus_cycles();
+		lockstat_acquired(NULL, splk->splk_site, spins > 0, spins,
+				  splk->splk_since - start);
+	}
+#endif
+
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
@@ -135,9 +193,24 @@ spinlock_release(struct spinlock *splk)
 		HANGMAN_RELEASE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
 
+#if OPT_LOCKSTAT
+	/* Skip locks taken before curcpu existed. */
+	if (CURCPU_EXISTS() && splk->splk_site != 0) {
+		lockstat_released(NULL, splk->splk_site,
+				  mainbus_cycles() - splk->splk_since);
+		splk->splk_site = 0;
+	}
+#endif
+
 	splk->splk_holder = NULL;
 	membar_any_store();
+#if OPT_TICKET_SPINLOCK
+	/* Only the holder writes this, so a plain increment will do. */
+	spinlock_data_set(&splk->splk_serving,
+			  spinlock_data_get(&splk->splk_serving) + 1);
+#else
 	spinlock_data_set(&splk->splk_lock, 0);
+#endif
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
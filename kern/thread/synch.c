@@ -33,12 +33,16 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <membar.h>
+#include <mainbus.h>
+#include <lockstat.h>
 
 #include "opt-lock_with_semaphores.h"
 #include "opt-lock_wchan_spinlock.h"
@@ -64,15 +68,21 @@ sem_create(const char *name, unsigned initial_count)
                 return NULL;
         }
 
+#if OPT_HASHED_WCHAN
+	sem->sem_wchan = &sem->sem_wchandata;
+	wchan_init(sem->sem_wchan, sem->sem_name);
+#else
 	sem->sem_wchan = wchan_create(sem->sem_name);
 	if (sem->sem_wchan == NULL) {
 		kfree(sem->sem_name);
 		kfree(sem);
 		return NULL;
 	}
+#endif
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+        sem->sem_sleepers = 0;
 
         return sem;
 }
@@ -82,13 +92,53 @@ sem_destroy(struct semaphore *sem)
 {
         KASSERT(sem != NULL);
 
+	/*
+	 * A V whose count our caller's P already took may still be
+	 * on its way out of the spinlock; let it finish.
+	 */
+	spinlock_acquire(&sem->sem_lock);
+	spinlock_release(&sem->sem_lock);
+
 	/* wchan_cleanup will assert if anyone's waiting on it */
 	spinlock_cleanup(&sem->sem_lock);
+#if OPT_HASHED_WCHAN
+	wchan_cleanup(sem->sem_wchan);
+#else
 	wchan_destroy(sem->sem_wchan);
+#endif
         kfree(sem->sem_name);
         kfree(sem);
 }
 
+/*
+ * Take one off the count if it's nonzero, without the spinlock.
+ * Returns true on success.
+ */
+static
+bool
+sem_tryP(struct semaphore *sem)
+{
+        unsigned count;
+
+        while ((count = sem->sem_count) > 0) {
+                if (spinlock_data_cas(&sem->sem_count, count, count - 1)) {
+                        membar_store_any();
+                        return true;
+                }
+        }
+        return false;
+}
+
+/*
+ * P only takes the spinlock when it has to sleep. A thread going to
+ * sleep counts itself in sem_sleepers before its last look at the
+ * count, and V bumps the count and looks at sem_sleepers under the
+ * spinlock, so the wakeup can't be lost.
+ *
+ * V always holds the spinlock while the new count is visible, because
+ * a lockless P can take it and destroy the semaphore right away
+ * (sem_destroy waits for the spinlock to be free first).
+ */
 void
 P(struct semaphore *sem)
 {
@@ -102,9 +152,15 @@ P(struct semaphore *sem)
          */
         KASSERT(curthread->t_in_interrupt == false);
 
+        if (sem_tryP(sem)) {
+                return;
+        }
+
 	/* Use the semaphore spinlock to protect the wchan as well. */
 	spinlock_acquire(&sem->sem_lock);
-        while (sem->sem_count == 0) {
+        sem->sem_sleepers++;
+        membar_any_any();
+        while (!sem_tryP(sem)) {
 		/*
 		 *
 		 * Note that we don't maintain strict FIFO ordering of
@@ -119,22 +175,65 @@ P(struct semaphore *sem)
 		 */
 		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
         }
-        KASSERT(sem->sem_count > 0);
-        sem->sem_count--;
+        sem->sem_sleepers--;
 	spinlock_release(&sem->sem_lock);
 }
 
-void
-V(struct semaphore *sem)
+int
+sem_timedP(struct semaphore *sem, unsigned ticks)
 {
+        int result;
+
         KASSERT(sem != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        if (sem_tryP(sem)) {
+                return 0;
+        }
 
 	spinlock_acquire(&sem->sem_lock);
+        sem->sem_sleepers++;
+        membar_any_any();
+        result = 0;
+        while (!sem_tryP(sem)) {
+                if (ticks == 0 || result == ETIMEDOUT) {
+                        sem->sem_sleepers--;
+                        spinlock_release(&sem->sem_lock);
+                        return ETIMEDOUT;
+                }
+		/*
+		 * If someone else got in first after we were woken
+		 * up, we start waiting all over again, so the total
+		 * wait can run longer than TICKS. It's never shorter.
+		 */
+		if (wchan_timedsleep(sem->sem_wchan, &sem->sem_lock, ticks)) {
+                        result = ETIMEDOUT;
+                }
+        }
+        sem->sem_sleepers--;
+	spinlock_release(&sem->sem_lock);
+
+        return 0;
+}
+
+void
+V(struct semaphore *sem)
+{
+        unsigned count;
 
-        sem->sem_count++;
-        KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+        KASSERT(sem != NULL);
 
+	spinlock_acquire(&sem->sem_lock);
+        membar_any_store();
+        do {
+                count = sem->sem_count;
+                KASSERT(count + 1 > 0);
+        } while (!spinlock_data_cas(&sem->sem_count, count, count + 1));
+
+        membar_any_any();
+        if (sem->sem_sleepers > 0) {
+                wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+        }
 	spinlock_release(&sem->sem_lock);
 }
 
@@ -142,6 +241,10 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+// how many times to poll a lock whose owner is running before
+// giving up and going to sleep
+#define LOCK_SPIN_MAX 1000
+
 struct lock *
 lock_create(const char *name)
 {
@@ -162,7 +265,9 @@ lock_create(const char *name)
 #if OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK
 
         // initially no one is holding the lock
-        lock->owner = NULL;
+        lock->lk_owner = 0;
+        lock->lk_waiters = NULL;
+        lock->lk_nextheld = NULL;
 
         // initialize the spinlock
         spinlock_init(&lock->spinlock);
@@ -178,6 +283,10 @@ lock_create(const char *name)
         }
 #else
         // initialize the wait channel
+#if OPT_HASHED_WCHAN
+        lock->lk_wchan = &lock->lk_wchandata;
+        wchan_init(lock->lk_wchan, lock->lk_name);
+#else
         lock->lk_wchan = wchan_create(lock->lk_name);
 	if (lock->lk_wchan == NULL) {
 		kfree(lock->lk_name);
@@ -185,6 +294,7 @@ lock_create(const char *name)
 		return NULL;
 	}
 #endif
+#endif
 
 #endif
 
@@ -199,16 +309,24 @@ lock_destroy(struct lock *lock)
         // add stuff here as needed
 #if OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK
 
-        if (lock->owner != NULL)
+        if (LOCK_OWNER(lock) != NULL)
         {
                 panic("Called lock_destroy on an acquired lock");
                 return;
         }
+        KASSERT(lock->lk_waiters == NULL);
+
+        // a slow-path release that already handed the lock over
+        // may still be on its way out of the spinlock; let it finish
+        spinlock_acquire(&lock->spinlock);
+        spinlock_release(&lock->spinlock);
 
         spinlock_cleanup(&lock->spinlock);
 
 #if OPT_LOCK_WITH_SEMAPHORES
         sem_destroy(lock->sem);
+#elif OPT_HASHED_WCHAN
+        wchan_cleanup(lock->lk_wchan);
 #else
         wchan_destroy(lock->lk_wchan);
 #endif
@@ -218,11 +336,39 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+#if OPT_LOCKSTAT
+// cycles from THEN to now. we may have moved to another cpu since,
+// whose cycle counter doesn't match, so don't go negative.
+static
+uint64_t
+lock_stat_since(uint64_t then)
+{
+        uint64_t now;
+
+        now = mainbus_cycles();
+        return now > then ? now - then : 0;
+}
+#endif
+
+#if OPT_LOCK_WCHAN_SPINLOCK
+// whether anyone is, or is about to be, waiting for the lock. call
+// with the spinlock held.
+static
+bool
+lock_contended(struct lock *lock)
+{
+        return lock->lk_waiters != NULL ||
+                !wchan_isempty(lock->lk_wchan, &lock->spinlock);
+}
+#endif
+
 void
 lock_acquire(struct lock *lock)
 {
 
 #if OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK
+        spinlock_data_t me;
+
         KASSERT(lock);
 
         // do not block inside interrupts
@@ -231,22 +377,112 @@ lock_acquire(struct lock *lock)
         // veriy i do not hold the lock
         KASSERT(!(lock_do_i_hold(lock)));
 
+        me = (spinlock_data_t)(uintptr_t)curthread;
+
+#if OPT_LOCKSTAT
+        uint64_t start = mainbus_cycles();
+#endif
+
 #if OPT_LOCK_WITH_SEMAPHORES
+        bool waiting;
+
+        // if someone holds the lock, lend them our priority while
+        // we wait. The owner may change before we get to P(), so
+        // this is best effort.
+        spinlock_acquire(&lock->spinlock);
+        waiting = LOCK_OWNER(lock) != NULL;
+        if (waiting) {
+                thread_pi_block(lock);
+        }
+        spinlock_release(&lock->spinlock);
+
         P(lock->sem);
 
         // acquire the spinlock and modify the owner thread
         spinlock_acquire(&lock->spinlock);
-        KASSERT(lock->owner == NULL);
-        lock->owner = curthread;
+        if (waiting) {
+                thread_pi_unblock(lock);
+        }
+        KASSERT(LOCK_OWNER(lock) == NULL);
+        lock->lk_owner = me;
+        thread_pi_acquired(lock);
         spinlock_release(&lock->spinlock);
+
+#if OPT_LOCKSTAT
+        lockstat_acquired(lock->lk_name, 0, waiting, 0,
+                          lock_stat_since(start));
+        lock->lk_since = mainbus_cycles();
+#endif
 #else
-        // acquire the spinlock and wait
+        spinlock_data_t word;
+        struct thread *owner;
+        unsigned spins;
+
+        // fast path: nobody has it and nobody is waiting for it.
+        if (spinlock_data_cas(&lock->lk_owner, 0, me)) {
+                membar_store_any();
+#if OPT_LOCKSTAT
+                lockstat_acquired(lock->lk_name, 0, false, 0, 0);
+                lock->lk_since = start;
+#endif
+                return;
+        }
+
+        // slow path. the owner (if any) has to see LOCK_CONTENDED
+        // before we go to sleep, so it takes the spinlock to release
+        // the lock and wakes us up. that also means it can't let go
+        // and disappear while we hold the spinlock.
         spinlock_acquire(&lock->spinlock);
-        while (lock->owner) {
+        spins = 0;
+        while (1) {
+                word = lock->lk_owner;
+                owner = LOCK_OWNER(lock);
+                if (owner == NULL) {
+                        // keep it marked if others are still waiting
+                        if (lock_contended(lock)) {
+                                me |= LOCK_CONTENDED;
+                        }
+                        if (spinlock_data_cas(&lock->lk_owner, word, me)) {
+                                break;
+                        }
+                        me &= ~LOCK_CONTENDED;
+                        continue;
+                }
+                if ((word & LOCK_CONTENDED) == 0) {
+                        spinlock_data_cas(&lock->lk_owner, word,
+                                          word | LOCK_CONTENDED);
+                        continue;
+                }
+
+                // if the owner is running on another cpu it will
+                // probably let go soon, which is much cheaper to wait
+                // for than two context switches. poll without holding
+                // the spinlock so we don't slow down the release.
+                if (owner->t_state == S_RUN && spins < LOCK_SPIN_MAX) {
+                        spinlock_release(&lock->spinlock);
+                        while (lock->lk_owner == word &&
+                               spins < LOCK_SPIN_MAX) {
+                                spins++;
+                        }
+                        spinlock_acquire(&lock->spinlock);
+                        continue;
+                }
+
+                // otherwise wait, lending our priority to the owner in
+                // the meantime
+                thread_pi_block(lock);
                 wchan_sleep(lock->lk_wchan, &lock->spinlock);
+                thread_pi_unblock(lock);
         }
-        lock->owner = curthread;
+        membar_store_any();
+        thread_pi_acquired(lock);
         spinlock_release(&lock->spinlock);
+
+#if OPT_LOCKSTAT
+        lockstat_acquired(lock->lk_name, 0, true, spins,
+                          lock_stat_since(start));
+        lock->lk_since = mainbus_cycles();
+#endif
 #endif
 
 #else
@@ -258,25 +494,46 @@ void
 lock_release(struct lock *lock)
 {
 #if OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK
-        spinlock_acquire(&lock->spinlock);
-        
-        if (lock->owner != curthread) {
-                spinlock_release(&lock->spinlock);
+        if (LOCK_OWNER(lock) != curthread) {
                 panic("How dare you?!");
                 return;
         }
 
-        // set owner to NULL
-        lock->owner = NULL;
+#if OPT_LOCKSTAT
+        lockstat_released(lock->lk_name, 0, lock_stat_since(lock->lk_since));
+#endif
 
 #if OPT_LOCK_WITH_SEMAPHORES
+        spinlock_acquire(&lock->spinlock);
+
+        // set owner to NULL and give back any inherited priority
+        lock->lk_owner = 0;
+        thread_pi_released(lock);
+
         // release the semaphore
         V(lock->sem);
+
+        spinlock_release(&lock->spinlock);
 #else
+        // fast path: nobody's waiting
+        membar_any_store();
+        if (spinlock_data_cas(&lock->lk_owner,
+                              (spinlock_data_t)(uintptr_t)curthread, 0)) {
+                return;
+        }
+
+        spinlock_acquire(&lock->spinlock);
+        KASSERT(lock->lk_owner & LOCK_CONTENDED);
+
+        // give back any inherited priority and wake the next waiter.
+        // if there are more, keep the lock marked so the next release
+        // wakes one too.
+        thread_pi_released(lock);
         wchan_wakeone(lock->lk_wchan, &lock->spinlock);
-#endif
+        lock->lk_owner = lock_contended(lock) ? LOCK_CONTENDED : 0;
 
         spinlock_release(&lock->spinlock);
+#endif
 #else
     (void) lock;
 #endif
@@ -286,13 +543,8 @@ bool
 lock_do_i_hold(struct lock *lock)
 {
 #if OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK
-        bool own = false;
-
-        spinlock_acquire(&lock->spinlock);
-        own = lock->owner == curthread;
-        spinlock_release(&lock->spinlock);
-
-        return own;
+        // only we can make this true or false, so no need to lock
+        return LOCK_OWNER(lock) == curthread;
 #else
 
     (void)lock;  // suppress warning until code gets written
@@ -305,6 +557,43 @@ lock_do_i_hold(struct lock *lock)
 //
 // CV
 
+#if (OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK) && OPT_CV_IMPLEMENTATION
+// wait morphing: signalled threads would only wake up to find the
+// lock held (by the signaller, at least) and go back to sleep, so
+// move them straight to the wait channel the lock wakes up from.
+// when they are woken from there they return from cv_wait's sleep
+// and take the lock as usual.
+//
+// semaphore-backed locks only wake sleepers that P counted in
+// sem_sleepers, which moved threads aren't, so those just get woken.
+static
+void
+cv_morph(struct cv *cv, struct lock *lock, bool all)
+{
+        KASSERT(spinlock_do_i_hold(&cv->spinlock));
+
+#if OPT_LOCK_WITH_SEMAPHORES
+        (void)lock;
+        if (all) {
+                wchan_wakeall(cv->cv_wchan, &cv->spinlock);
+        }
+        else {
+                wchan_wakeone(cv->cv_wchan, &cv->spinlock);
+        }
+#else
+        spinlock_acquire(&lock->spinlock);
+        wchan_transfer(cv->cv_wchan, &cv->spinlock,
+                       lock->lk_wchan, &lock->spinlock, all);
+
+        // make sure our release goes through the spinlock and wakes
+        // them. we hold the lock, so nobody else changes the owner.
+        if (lock_contended(lock)) {
+                lock->lk_owner |= LOCK_CONTENDED;
+        }
+        spinlock_release(&lock->spinlock);
+#endif
+}
+#endif
 
 struct cv *
 cv_create(const char *name)
@@ -326,12 +615,17 @@ cv_create(const char *name)
         // initialize the spinlock
         spinlock_init(&cv->spinlock);
 
+#if OPT_HASHED_WCHAN
+        cv->cv_wchan = &cv->cv_wchandata;
+        wchan_init(cv->cv_wchan, cv->cv_name);
+#else
         cv->cv_wchan = wchan_create(cv->cv_name);
 	if (cv->cv_wchan == NULL) {
 		kfree(cv->cv_name);
 		kfree(cv);
 		return NULL;
 	}
+#endif
 #endif
 
         return cv;
@@ -344,7 +638,11 @@ cv_destroy(struct cv *cv)
 
 #if (OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK) && OPT_CV_IMPLEMENTATION
 
+#if OPT_HASHED_WCHAN
+        wchan_cleanup(cv->cv_wchan);
+#else
         wchan_destroy(cv->cv_wchan);
+#endif
         spinlock_cleanup(&cv->spinlock);
         
 #endif
@@ -382,6 +680,37 @@ cv_wait(struct cv *cv, struct lock *lock)
 #endif
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks)
+{
+#if (OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK) && OPT_CV_IMPLEMENTATION
+        bool expired;
+
+        KASSERT(lock);
+        KASSERT(cv);
+
+        // verify current thread is holding the lock
+        KASSERT(lock_do_i_hold(lock));
+
+        // same as cv_wait, but with a timeout on the sleep
+        spinlock_acquire(&cv->spinlock);
+        lock_release(lock);
+        expired = wchan_timedsleep(cv->cv_wchan, &cv->spinlock, ticks);
+        spinlock_release(&cv->spinlock);
+
+        // reacquire the lock
+        lock_acquire(lock);
+
+        return expired ? ETIMEDOUT : 0;
+#else
+        (void)cv;
+        (void)lock;
+        (void)ticks;
+
+        return 0;
+#endif
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -392,9 +721,10 @@ cv_signal(struct cv *cv, struct lock *lock)
         // verify current thread is holding the lock
         KASSERT(lock_do_i_hold(lock));
 
-        // acquire the spinlock and wake one sleeping thread
+        // acquire the spinlock and hand one sleeping thread over to
+        // the lock
         spinlock_acquire(&cv->spinlock);
-        wchan_wakeone(cv->cv_wchan, &cv->spinlock);
+        cv_morph(cv, lock, false);
         spinlock_release(&cv->spinlock);
 #else
         // Write this
@@ -413,9 +743,10 @@ cv_broadcast(struct cv *cv, struct lock *lock)
         // verify current thread is holding the lock
         KASSERT(lock_do_i_hold(lock));
 
-        // acquire the spinlock and wake all the sleeping threads
+        // acquire the spinlock and hand all the sleeping threads
+        // over to the lock
         spinlock_acquire(&cv->spinlock);
-        wchan_wakeall(cv->cv_wchan, &cv->spinlock);
+        cv_morph(cv, lock, true);
         spinlock_release(&cv->spinlock);
 #else
 	// Write this
@@ -423,3 +754,335 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	(void)lock;  // suppress warning until code gets written
 #endif
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name, unsigned flags)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(*rw));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rwlock_name = kstrdup(name);
+        if (rw->rwlock_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+#if OPT_HASHED_WCHAN
+        rw->rwlock_rwchan = &rw->rwlock_rwchandata;
+        rw->rwlock_wwchan = &rw->rwlock_wwchandata;
+        wchan_init(rw->rwlock_rwchan, rw->rwlock_name);
+        wchan_init(rw->rwlock_wwchan, rw->rwlock_name);
+#else
+        rw->rwlock_rwchan = wchan_create(rw->rwlock_name);
+        if (rw->rwlock_rwchan == NULL) {
+                kfree(rw->rwlock_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rwlock_wwchan = wchan_create(rw->rwlock_name);
+        if (rw->rwlock_wwchan == NULL) {
+                wchan_destroy(rw->rwlock_rwchan);
+                kfree(rw->rwlock_name);
+                kfree(rw);
+                return NULL;
+        }
+#endif
+
+        spinlock_init(&rw->rwlock_lock);
+        rw->rwlock_flags = flags;
+        rw->rwlock_readers = 0;
+        rw->rwlock_writer = NULL;
+        rw->rwlock_rwaiting = 0;
+        rw->rwlock_wwaiting = 0;
+        rw->rwlock_rpass = 0;
+
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rwlock_readers == 0);
+        KASSERT(rw->rwlock_writer == NULL);
+
+        // wchan_destroy asserts nobody is waiting
+        spinlock_cleanup(&rw->rwlock_lock);
+#if OPT_HASHED_WCHAN
+        wchan_cleanup(rw->rwlock_rwchan);
+        wchan_cleanup(rw->rwlock_wwchan);
+#else
+        wchan_destroy(rw->rwlock_rwchan);
+        wchan_destroy(rw->rwlock_wwchan);
+#endif
+        kfree(rw->rwlock_name);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rwlock_lock);
+        KASSERT(rw->rwlock_writer != curthread);
+
+        // with writer preference, stay out of the way of waiting
+        // writers unless a writer has just let us through
+        while (rw->rwlock_writer != NULL ||
+               (rw->rwlock_flags != 0 && rw->rwlock_wwaiting > 0 &&
+                rw->rwlock_rpass == 0)) {
+                rw->rwlock_rwaiting++;
+                wchan_sleep(rw->rwlock_rwchan, &rw->rwlock_lock);
+                rw->rwlock_rwaiting--;
+        }
+        if (rw->rwlock_rpass > 0) {
+                rw->rwlock_rpass--;
+        }
+        rw->rwlock_readers++;
+
+        spinlock_release(&rw->rwlock_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rwlock_lock);
+        KASSERT(rw->rwlock_readers > 0);
+
+        rw->rwlock_readers--;
+        if (rw->rwlock_readers == 0 && rw->rwlock_rpass == 0 &&
+            rw->rwlock_wwaiting > 0) {
+                wchan_wakeone(rw->rwlock_wwchan, &rw->rwlock_lock);
+        }
+
+        spinlock_release(&rw->rwlock_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rwlock_lock);
+        KASSERT(rw->rwlock_writer != curthread);
+
+        // readers that were let through go first (see below)
+        while (rw->rwlock_writer != NULL || rw->rwlock_readers > 0 ||
+               rw->rwlock_rpass > 0) {
+                rw->rwlock_wwaiting++;
+                wchan_sleep(rw->rwlock_wwchan, &rw->rwlock_lock);
+                rw->rwlock_wwaiting--;
+        }
+        rw->rwlock_writer = curthread;
+
+        spinlock_release(&rw->rwlock_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rwlock_lock);
+        KASSERT(rw->rwlock_writer == curthread);
+
+        rw->rwlock_writer = NULL;
+
+        if ((rw->rwlock_flags & RWLOCK_FAIR) && rw->rwlock_rwaiting > 0) {
+                // let the readers that waited for us go in as a batch,
+                // even if other writers are waiting too
+                rw->rwlock_rpass = rw->rwlock_rwaiting;
+                wchan_wakeall(rw->rwlock_rwchan, &rw->rwlock_lock);
+        }
+        else if (rw->rwlock_flags != 0 && rw->rwlock_wwaiting > 0) {
+                wchan_wakeone(rw->rwlock_wwchan, &rw->rwlock_lock);
+        }
+        else {
+                wchan_wakeall(rw->rwlock_rwchan, &rw->rwlock_lock);
+                wchan_wakeone(rw->rwlock_wwchan, &rw->rwlock_lock);
+        }
+
+        spinlock_release(&rw->rwlock_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Barrier.
+
+struct barrier *
+barrier_create(const char *name, unsigned count)
+{
+        struct barrier *b;
+
+        KASSERT(count > 0);
+
+        b = kmalloc(sizeof(*b));
+        if (b == NULL) {
+                return NULL;
+        }
+
+        b->barrier_name = kstrdup(name);
+        if (b->barrier_name == NULL) {
+                kfree(b);
+                return NULL;
+        }
+
+#if OPT_HASHED_WCHAN
+        b->barrier_wchan = &b->barrier_wchandata;
+        wchan_init(b->barrier_wchan, b->barrier_name);
+#else
+        b->barrier_wchan = wchan_create(b->barrier_name);
+        if (b->barrier_wchan == NULL) {
+                kfree(b->barrier_name);
+                kfree(b);
+                return NULL;
+        }
+#endif
+
+        spinlock_init(&b->barrier_lock);
+        b->barrier_count = count;
+        b->barrier_waiting = 0;
+        b->barrier_round = 0;
+
+        return b;
+}
+
+void
+barrier_destroy(struct barrier *b)
+{
+        KASSERT(b != NULL);
+        KASSERT(b->barrier_waiting == 0);
+
+        spinlock_cleanup(&b->barrier_lock);
+#if OPT_HASHED_WCHAN
+        wchan_cleanup(b->barrier_wchan);
+#else
+        wchan_destroy(b->barrier_wchan);
+#endif
+        kfree(b->barrier_name);
+        kfree(b);
+}
+
+bool
+barrier_wait(struct barrier *b)
+{
+        unsigned round;
+
+        KASSERT(b != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&b->barrier_lock);
+
+        if (++b->barrier_waiting == b->barrier_count) {
+                // last one in: start the next round and let everyone go
+                b->barrier_waiting = 0;
+                b->barrier_round++;
+                wchan_wakeall(b->barrier_wchan, &b->barrier_lock);
+                spinlock_release(&b->barrier_lock);
+                return true;
+        }
+
+        // the round number, not the count, says when we're done, since
+        // the count starts over as soon as the round ends
+        round = b->barrier_round;
+        while (b->barrier_round == round) {
+                wchan_sleep(b->barrier_wchan, &b->barrier_lock);
+        }
+
+        spinlock_release(&b->barrier_lock);
+        return false;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Countdown latch.
+
+struct latch *
+latch_create(const char *name, unsigned count)
+{
+        struct latch *l;
+
+        l = kmalloc(sizeof(*l));
+        if (l == NULL) {
+                return NULL;
+        }
+
+        l->latch_name = kstrdup(name);
+        if (l->latch_name == NULL) {
+                kfree(l);
+                return NULL;
+        }
+
+#if OPT_HASHED_WCHAN
+        l->latch_wchan = &l->latch_wchandata;
+        wchan_init(l->latch_wchan, l->latch_name);
+#else
+        l->latch_wchan = wchan_create(l->latch_name);
+        if (l->latch_wchan == NULL) {
+                kfree(l->latch_name);
+                kfree(l);
+                return NULL;
+        }
+#endif
+
+        spinlock_init(&l->latch_lock);
+        l->latch_count = count;
+
+        return l;
+}
+
+void
+latch_destroy(struct latch *l)
+{
+        KASSERT(l != NULL);
+
+        // wchan_destroy asserts nobody is waiting
+        spinlock_cleanup(&l->latch_lock);
+#if OPT_HASHED_WCHAN
+        wchan_cleanup(l->latch_wchan);
+#else
+        wchan_destroy(l->latch_wchan);
+#endif
+        kfree(l->latch_name);
+        kfree(l);
+}
+
+void
+latch_countdown(struct latch *l)
+{
+        KASSERT(l != NULL);
+
+        spinlock_acquire(&l->latch_lock);
+        KASSERT(l->latch_count > 0);
+        if (--l->latch_count == 0) {
+                wchan_wakeall(l->latch_wchan, &l->latch_lock);
+        }
+        spinlock_release(&l->latch_lock);
+}
+
+void
+latch_wait(struct latch *l)
+{
+        KASSERT(l != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&l->latch_lock);
+        while (l->latch_count > 0) {
+                wchan_sleep(l->latch_wchan, &l->latch_lock);
+        }
+        spinlock_release(&l->latch_lock);
+}
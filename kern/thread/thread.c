@@ -37,6 +37,7 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <array.h>
+#include <clock.h>
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
@@ -50,16 +51,45 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <lockstat.h>
+#include <rcu.h>
+#include "opt-lock_with_semaphores.h"
+#include "opt-lock_wchan_spinlock.h"
+#include "opt-hashed_wchan.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/* Number of dead threads (with their stacks) each cpu keeps for reuse. */
+#define THREAD_CACHE_MAX 8
+
+/*
+ * Scheduler parameters: number of priority levels, and the quantum
+ * (in hardclocks) a thread gets at each level before being demoted.
+ */
+#define SCHED_NLEVELS 4
+static const unsigned sched_quantum[SCHED_NLEVELS] = { 1, 2, 4, 8 };
+
+/* Bumped at each priority boost; see schedule(). */
+static volatile unsigned sched_epoch;
+
+/*
+ * A thread is considered cache-hot on its cpu if it stopped running
+ * there less than this many hardclocks ago.
+ */
+#define SCHED_CACHEHOT 2
+
+/* True if thread T may run on cpu C. */
+#define THREAD_CANRUN(t, c) (((t)->t_affinity >> (c)->c_number) & 1)
+
+#if !OPT_HASHED_WCHAN
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
 	struct threadlist wc_threads;	/* list of waiting threads */
 };
+#endif
 
 /* Master array of CPUs. */
 DECLARRAY(cpu, static __UNUSED inline);
@@ -67,7 +97,13 @@ DEFARRAY(cpu, static __UNUSED inline);
 static struct cpuarray allcpus;
 
 /* Used to wait for secondary CPUs to come online. */
-static struct semaphore *cpu_startup_sem;
+static struct latch *cpu_startup_latch;
+
+static void thread_idle(void *junk1, unsigned long junk2);
+static void wchan_enqueue(struct wchan *wc, struct thread *t);
+#if OPT_HASHED_WCHAN
+static void wchan_bootstrap(void);
+#endif
 
 ////////////////////////////////////////////////////////////
 
@@ -109,34 +145,57 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set a thread's name. Short names, which are the common case, are
+ * stored in the thread structure itself so that creating a thread
+ * does not normally have to kmalloc a copy.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_setname(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
-	DEBUGASSERT(name != NULL);
-
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (strlen(name) < sizeof(thread->t_namebuf)) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
+	}
+	else {
+		thread->t_name = kstrdup(name);
+		if (thread->t_name == NULL) {
+			return ENOMEM;
+		}
 	}
+	return 0;
+}
 
-	thread->t_name = kstrdup(name);
-	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+/*
+ * Release the name set with thread_setname.
+ */
+static
+void
+thread_freename(struct thread *thread)
+{
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
 	}
+	thread->t_name = NULL;
+}
+
+/*
+ * Initialize the fields of a new (or recycled) thread, other than
+ * its name and stack.
+ */
+static
+void
+thread_initfields(struct thread *thread)
+{
 	thread->t_wchan_name = "NEW";
+#if OPT_HASHED_WCHAN
+	thread->t_wchan = NULL;
+#endif
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -147,11 +206,120 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Scheduler fields; new threads start at the top level */
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_epoch = sched_epoch;
+	thread->t_inherited = SCHED_NLEVELS;
+	thread->t_waitlock = NULL;
+	thread->t_nextwaiter = NULL;
+	thread->t_heldlocks = NULL;
+
+	/* Placement fields */
+	thread->t_affinity = THREAD_AFFINITY_ALL;
+	thread->t_lastrun = 0;
+	thread->t_migrations = 0;
+	thread->t_rcu_nest = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	DEBUGASSERT(name != NULL);
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (thread_setname(thread, name)) {
+		kfree(thread);
+		return NULL;
+	}
+	thread->t_stack = NULL;
+	thread_initfields(thread);
+
+	return thread;
+}
+
+/*
+ * Per-cpu cache of dead threads.
+ *
+ * Rather than freeing a dead thread's structure and stack, keep up to
+ * THREAD_CACHE_MAX of them on the cpu they died on, so thread_fork
+ * can pick one up without calling kmalloc at all. The cache is only
+ * touched by its own cpu, so disabling interrupts is enough to
+ * protect it.
+ */
+
+/*
+ * Take a thread, complete with stack, from the current cpu's cache.
+ * Returns NULL if the cache is empty.
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+
+	if (thread == NULL) {
+		return NULL;
+	}
+	KASSERT(thread->t_stack != NULL);
+
+	if (thread_setname(thread, name)) {
+		spl = splhigh();
+		threadlist_addhead(&curcpu->c_threadcache, thread);
+		splx(spl);
+		return NULL;
+	}
+	thread_initfields(thread);
+	thread_checkstack_init(thread);
 
 	return thread;
 }
 
+/*
+ * Put a dead thread in the current cpu's cache. Returns false if the
+ * thread can't be cached and should be freed instead.
+ */
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	struct cpu *c;
+	bool ret;
+	int spl;
+
+	if (thread->t_stack == NULL || !CURCPU_EXISTS()) {
+		return false;
+	}
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	ret = c->c_threadcache.tl_count < THREAD_CACHE_MAX;
+	if (ret) {
+		threadlist_addhead(&c->c_threadcache, thread);
+	}
+	splx(spl);
+
+	return ret;
+}
+
 /*
  * Create a CPU structure. This is used for the bootup CPU and
  * also for secondary CPUs.
@@ -175,15 +343,28 @@ cpu_create(unsigned hardware_number)
 	c->c_self = c;
 	c->c_hardware_number = hardware_number;
 
+	c->c_idlethread = NULL;
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
+	c->c_migrant = NULL;
+	c->c_workqueue = NULL;
 	c->c_hardclocks = 0;
+	c->c_tickless = 0;
 	c->c_spinlocks = 0;
+#if OPT_LOCKSTAT
+	c->c_lockstat = lockstat_create();
+#else
+	c->c_lockstat = NULL;
+#endif
 
 	c->c_isidle = false;
+	c->c_rcu_epoch = 0;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
 
+	timerwheel_init(&c->c_timers);
+
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
@@ -192,6 +373,8 @@ cpu_create(unsigned hardware_number)
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	/* Affinity masks have one bit per cpu. */
+	KASSERT(c->c_number < 32);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -247,11 +430,48 @@ cpu_create(unsigned hardware_number)
 		panic("cpu_create: proc_addthread:: %s\n", strerror(result));
 	}
 
+	/*
+	 * Create the idle thread. It is set up like a new thread from
+	 * thread_fork, except that it never goes on a run queue;
+	 * thread_switch picks it directly when there's nothing else
+	 * to run.
+	 */
+	snprintf(namebuf, sizeof(namebuf), "<idle #%d>", c->c_number);
+	c->c_idlethread = thread_create(namebuf);
+	if (c->c_idlethread == NULL) {
+		panic("cpu_create: thread_create failed\n");
+	}
+	c->c_idlethread->t_stack = kmalloc(STACK_SIZE);
+	if (c->c_idlethread->t_stack == NULL) {
+		panic("cpu_create: couldn't allocate idle stack");
+	}
+	thread_checkstack_init(c->c_idlethread);
+	c->c_idlethread->t_cpu = c;
+	c->c_idlethread->t_affinity = (uint32_t)1 << c->c_number;
+	result = proc_addthread(kproc, c->c_idlethread);
+	if (result) {
+		panic("cpu_create: proc_addthread:: %s\n", strerror(result));
+	}
+	c->c_idlethread->t_iplhigh_count++;
+	switchframe_init(c->c_idlethread, thread_idle, NULL, 0);
+
 	cpu_machdep_init(c);
 
 	return c;
 }
 
+/*
+ * Look up a cpu by number.
+ */
+struct cpu *
+cpu_lookup(unsigned software_number)
+{
+	if (software_number >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, software_number);
+}
+
 /*
  * Destroy a thread.
  *
@@ -274,16 +494,22 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
+	thread_freename(thread);
+
+	/* Keep the structure and stack for reuse if there's room. */
+	if (thread_cache_put(thread)) {
+		return;
+	}
+
+	if (thread->t_stack != NULL) {
+		kfree(thread->t_stack);
+	}
 	kfree(thread);
 }
 
@@ -372,6 +598,9 @@ void
 thread_bootstrap(void)
 {
 	cpuarray_init(&allcpus);
+#if OPT_HASHED_WCHAN
+	wchan_bootstrap();
+#endif
 
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
@@ -400,7 +629,8 @@ thread_bootstrap(void)
  *
  * Other than clearing thread_start_cpus() to continue, we don't need
  * to do anything. The startup thread can just exit; we only need it
- * to be able to get into thread_switch() properly.
+ * to be able to get into thread_switch() properly, which then runs
+ * the cpu's idle thread until there's something else to do.
  */
 void
 cpu_hatch(unsigned software_number)
@@ -416,7 +646,7 @@ cpu_hatch(unsigned software_number)
 
 	kprintf("cpu%u: %s\n", software_number, buf);
 
-	V(cpu_startup_sem);
+	latch_countdown(cpu_startup_latch);
 	thread_exit();
 }
 
@@ -427,19 +657,226 @@ void
 thread_start_cpus(void)
 {
 	char buf[64];
-	unsigned i;
 
 	cpu_identify(buf, sizeof(buf));
 	kprintf("cpu0: %s\n", buf);
 
-	cpu_startup_sem = sem_create("cpu_hatch", 0);
+	cpu_startup_latch = latch_create("cpu_hatch",
+					 cpuarray_num(&allcpus) - 1);
+	if (cpu_startup_latch == NULL) {
+		panic("thread_start_cpus: latch_create failed\n");
+	}
 	mainbus_start_cpus();
 
-	for (i=0; i<cpuarray_num(&allcpus) - 1; i++) {
-		P(cpu_startup_sem);
+	latch_wait(cpu_startup_latch);
+	latch_destroy(cpu_startup_latch);
+	cpu_startup_latch = NULL;
+}
+
+/*
+ * Work stealing.
+ *
+ * Rather than having busy cpus periodically push threads to other
+ * cpus, a cpu that runs out of work pulls a thread from the run
+ * queue of the busiest other cpu before going idle (see
+ * thread_idle). To keep the latency down when work appears while a
+ * cpu is already idle, thread_make_runnable pokes an idle cpu with
+ * IPI_UNIDLE whenever it queues a thread on a busy one.
+ *
+ * Migrating threads isn't free because of cache affinity; a thread's
+ * working cache set will end up having to be moved to the other CPU,
+ * which is fairly slow. But stealing only when a cpu would otherwise
+ * sit idle means we only pay that when the alternative is wasting a
+ * whole cpu.
+ *
+ * Both functions look at other cpus' run queue counts and idle flags
+ * without locking; these are only hints, and the run queue lock is
+ * taken before actually moving anything.
+ */
+
+/*
+ * Send IPI_UNIDLE to one idle cpu other than BUSY, if there is one.
+ */
+static
+void
+thread_kick_idle(struct cpu *busy)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c != curcpu->c_self && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * True if thread T, which isn't running, is likely to still have a
+ * warm cache footprint on t_cpu.
+ */
+static
+bool
+thread_cachehot(struct thread *t)
+{
+	return t->t_cpu->c_hardclocks - t->t_lastrun < SCHED_CACHEHOT;
+}
+
+/*
+ * Reassign thread T, which isn't running or on any run queue, to
+ * cpu C.
+ */
+static
+void
+thread_migrate(struct thread *t, struct cpu *c)
+{
+	KASSERT(THREAD_CANRUN(t, c));
+
+	if (t->t_cpu != c) {
+		DEBUG(DB_THREADS, "Migrating thread %s: cpu %u -> %u",
+		      t->t_name, t->t_cpu->c_number, c->c_number);
+		t->t_migrations++;
+		t->t_cpu = c;
+	}
+}
+
+/*
+ * Take a ready thread from the busiest other cpu and return it,
+ * reassigned to the current cpu. Returns NULL if there's nothing to
+ * steal. The caller must not hold any run queue lock.
+ *
+ * Threads not allowed to run here are passed over. So are threads
+ * that are still cache-hot on the victim, unless others are waiting
+ * there too; otherwise the victim will probably get around to them
+ * soon enough that moving their cache footprint isn't worth it.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	unsigned i, numcpus, best_count;
+	struct cpu *c, *victim;
+	struct thread *t;
+
+	victim = NULL;
+	best_count = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self && c->c_runqueue.tl_count > best_count) {
+			victim = c;
+			best_count = c->c_runqueue.tl_count;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	/*
+	 * Take from the tail, which is the lowest-priority thread and
+	 * the one that would otherwise wait longest.
+	 */
+	THREADLIST_FORALL_REV(t, victim->c_runqueue) {
+		KASSERT(t != victim->c_curthread);
+		if (THREAD_CANRUN(t, curcpu) &&
+		    (victim->c_runqueue.tl_count > 1 || !thread_cachehot(t))) {
+			break;
+		}
+	}
+	if (t != NULL) {
+		threadlist_remove(&victim->c_runqueue, t);
+		thread_migrate(t, curcpu->c_self);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	return t;
+}
+
+/*
+ * The level a thread is scheduled at: its own, or the one lent to it
+ * through a lock it holds, whichever is better.
+ */
+static
+unsigned
+thread_level(const struct thread *t)
+{
+	return t->t_inherited < t->t_priority ? t->t_inherited : t->t_priority;
+}
+
+/*
+ * Put a thread on a cpu's run queue, which is kept sorted by
+ * priority level. The thread goes behind any others at the same
+ * level, so each level is round-robin.
+ *
+ * If a priority boost has happened since the thread last ran (it
+ * was probably asleep), it gets the boost now.
+ */
+static
+void
+thread_enqueue(struct cpu *c, struct thread *t)
+{
+	struct thread *other;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (t->t_epoch != sched_epoch) {
+		t->t_epoch = sched_epoch;
+		t->t_priority = 0;
+		t->t_ticks = 0;
+	}
+
+	THREADLIST_FORALL_REV(other, c->c_runqueue) {
+		if (thread_level(other) <= thread_level(t)) {
+			threadlist_insertafter(&c->c_runqueue, other, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, t);
+}
+
+/*
+ * Choose a cpu for a thread that is becoming runnable and isn't
+ * running or queued anywhere. Normally that's the cpu it last ran
+ * on, where some of its working set may still be cached. But:
+ *   - if it isn't allowed there any more, use the allowed cpu with
+ *     the shortest run queue;
+ *   - if we're in an interrupt handler, this is most likely an I/O
+ *     completion waking up the thread that was waiting for it. If
+ *     the thread's cache on its old cpu has gone cold anyway, bring
+ *     it here instead, next to the data the device just delivered.
+ *
+ * The run queue counts are read without locking; they're only hints.
+ */
+static
+struct cpu *
+thread_choose_cpu(struct thread *t)
+{
+	unsigned i, numcpus;
+	struct cpu *c, *best;
+
+	if (THREAD_CANRUN(t, t->t_cpu)) {
+		if (curthread->t_in_interrupt && t->t_cpu != curcpu->c_self &&
+		    THREAD_CANRUN(t, curcpu) && !thread_cachehot(t)) {
+			return curcpu->c_self;
+		}
+		return t->t_cpu;
+	}
+
+	best = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (THREAD_CANRUN(t, c) && (best == NULL ||
+		    c->c_runqueue.tl_count < best->c_runqueue.tl_count)) {
+			best = c;
+		}
 	}
-	sem_destroy(cpu_startup_sem);
-	cpu_startup_sem = NULL;
+	KASSERT(best != NULL);
+	return best;
 }
 
 /*
@@ -462,18 +899,41 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 	else {
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
+
+		/*
+		 * The cpu the thread last ran on holds its run queue
+		 * lock until it has completely switched away from the
+		 * thread, so now that we have it the thread can be
+		 * moved somewhere else if that's a better place.
+		 */
+		targetcpu = thread_choose_cpu(target);
+		if (targetcpu != target->t_cpu) {
+			spinlock_release(&target->t_cpu->c_runqueue_lock);
+			thread_migrate(target, targetcpu);
+			spinlock_acquire(&targetcpu->c_runqueue_lock);
+		}
 	}
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_enqueue(targetcpu, target);
 
-	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
+	if (targetcpu->c_isidle) {
+		if (targetcpu != curcpu->c_self) {
+			/*
+			 * Other processor is idle; send interrupt to
+			 * make sure it unidles.
+			 */
+			ipi_send(targetcpu, IPI_UNIDLE);
+		}
+	}
+	else {
 		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
+		 * The target is busy, so the thread will have to
+		 * wait. If some other cpu is idle, poke it so it can
+		 * come and steal it.
 		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
+		thread_kick_idle(targetcpu);
 	}
 
 	if (!already_have_lock) {
@@ -500,18 +960,22 @@ thread_fork(const char *name,
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
+	/* Recycle a dead thread if we can; otherwise make a new one. */
+	newthread = thread_cache_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -519,6 +983,7 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -548,9 +1013,33 @@ thread_fork(const char *name,
 }
 
 /*
- * High level, machine-independent context switch code.
- *
- * The current thread is queued appropriately and its state is changed
+ * Finish a context switch, in the context of the thread switched
+ * to: unlock the run queue, which thread_switch leaves locked, and
+ * send on any thread that was switched out because it has to move
+ * to another cpu. Called from the tail of thread_switch and from
+ * thread_startup.
+ */
+static
+void
+thread_switch_finish(void)
+{
+	struct thread *migrant;
+
+	migrant = curcpu->c_migrant;
+	curcpu->c_migrant = NULL;
+
+	/* Unlock the run queue. */
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (migrant != NULL) {
+		thread_make_runnable(migrant, false);
+	}
+}
+
+/*
+ * High level, machine-independent context switch code.
+ *
+ * The current thread is queued appropriately and its state is changed
  * to NEWSTATE; another thread to run is selected and switched to.
  *
  * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
@@ -572,14 +1061,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 
 	cur = curthread;
 
-	/*
-	 * If we're idle, return without doing anything. This happens
-	 * when the timer interrupt interrupts the idle loop.
-	 */
-	if (curcpu->c_isidle) {
-		splx(spl);
-		return;
-	}
+	/* The idle thread only ever yields. */
+	KASSERT(cur != curcpu->c_idlethread || newstate == S_READY);
+
+	/* RCU readers may not sleep or be switched out. */
+	KASSERT(cur->t_rcu_nest == 0);
 
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
@@ -587,8 +1073,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. (Unless
+	 * we're no longer allowed on this cpu and have to move.)
+	 */
+	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue) &&
+	    THREAD_CANRUN(cur, curcpu)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -599,7 +1089,20 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
-		thread_make_runnable(cur, true /*have lock*/);
+		if (cur == curcpu->c_idlethread) {
+			/* The idle thread never goes on the run queue. */
+		}
+		else if (!THREAD_CANRUN(cur, curcpu)) {
+			/*
+			 * Our affinity changed. We can't go on another
+			 * cpu's run queue until we're off this stack, so
+			 * thread_switch_finish sends us on afterwards.
+			 */
+			curcpu->c_migrant = cur;
+		}
+		else {
+			thread_make_runnable(cur, true /*have lock*/);
+		}
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
@@ -611,7 +1114,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		 * caller of wchan_sleep locked it until the thread is
 		 * on the list.
 		 */
-		threadlist_addtail(&wc->wc_threads, cur);
+		wchan_enqueue(wc, cur);
 		spinlock_release(lk);
 		break;
 	    case S_ZOMBIE:
@@ -620,35 +1123,26 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		break;
 	}
 	cur->t_state = newstate;
+	cur->t_lastrun = curcpu->c_hardclocks;
 
 	/*
-	 * Get the next thread. While there isn't one, call cpu_idle().
-	 * curcpu->c_isidle must be true when cpu_idle is
-	 * called. Unlock the runqueue while idling too, to make sure
-	 * things can be added to it.
-	 *
-	 * Note that we don't need to unlock the runqueue atomically
-	 * with idling; becoming unidle requires receiving an
-	 * interrupt (either a hardware interrupt or an interprocessor
-	 * interrupt from another cpu posting a wakeup) and idling
-	 * *is* atomic with respect to re-enabling interrupts.
+	 * Get the next thread. If there isn't one, switch to the idle
+	 * thread, which looks for work to steal and idles the cpu
+	 * until there's something to do. The cpu counts as idle
+	 * whenever the idle thread is running.
 	 *
-	 * Note that c_isidle becomes true briefly even if we don't go
-	 * idle. However, because one is supposed to hold the runqueue
-	 * lock to look at it, this should not be visible or matter.
+	 * Because a cpu never idles on some other thread's stack, a
+	 * thread that is asleep or on a run queue is never in use by
+	 * any cpu once that cpu's run queue lock has been released.
 	 */
+	next = threadlist_remhead(&curcpu->c_runqueue);
+	if (next == NULL) {
+		next = curcpu->c_idlethread;
+	}
+	curcpu->c_isidle = (next == curcpu->c_idlethread);
 
-	/* The current cpu is now idle. */
-	curcpu->c_isidle = true;
-	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
-		if (next == NULL) {
-			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
-			spinlock_acquire(&curcpu->c_runqueue_lock);
-		}
-	} while (next == NULL);
-	curcpu->c_isidle = false;
+	/* Switching threads is a quiescent state for RCU. */
+	rcu_quiescent();
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -714,8 +1208,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
-	/* Unlock the run queue. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	/* Unlock the run queue, and send off any thread leaving. */
+	thread_switch_finish();
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -748,7 +1242,7 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	cur->t_state = S_RUN;
 
 	/* Release the runqueue lock acquired in thread_switch. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	thread_switch_finish();
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -814,151 +1308,618 @@ thread_yield(void)
 	thread_switch(S_READY, NULL, NULL);
 }
 
+/*
+ * The idle thread. Each cpu has one, which thread_switch runs when
+ * there's nothing on the run queue. It tries to steal work from
+ * other cpus and, failing that, idles the processor until an
+ * interrupt comes in; then it yields to whatever became runnable.
+ *
+ * Note that we don't need to check the run queue atomically with
+ * idling; becoming unidle requires receiving an interrupt (either a
+ * hardware interrupt or an interprocessor interrupt from another cpu
+ * posting a wakeup) and idling *is* atomic with respect to
+ * re-enabling interrupts.
+ */
+static
+void
+thread_idle(void *junk1, unsigned long junk2)
+{
+	struct thread *t;
+	bool empty;
+	int spl;
+
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		spl = splhigh();
+
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		empty = threadlist_isempty(&curcpu->c_runqueue);
+		spinlock_release(&curcpu->c_runqueue_lock);
+
+		if (empty) {
+			t = thread_steal();
+			if (t != NULL) {
+				spinlock_acquire(&curcpu->c_runqueue_lock);
+				thread_enqueue(curcpu->c_self, t);
+				spinlock_release(&curcpu->c_runqueue_lock);
+			}
+			else {
+				hardclock_idle();
+				cpu_idle();
+				hardclock_unidle();
+			}
+		}
+
+		splx(spl);
+		thread_yield();
+	}
+}
+
+/*
+ * Hard affinity.
+ */
+int
+thread_setaffinity(uint32_t mask)
+{
+	unsigned numcpus;
+
+	KASSERT(curthread != curcpu->c_idlethread);
+
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus < 32) {
+		mask &= ((uint32_t)1 << numcpus) - 1;
+	}
+	if (mask == 0) {
+		return EINVAL;
+	}
+
+	curthread->t_affinity = mask;
+
+	/* If we have to move, thread_switch takes care of it. */
+	if (!THREAD_CANRUN(curthread, curcpu)) {
+		thread_yield();
+	}
+	KASSERT(THREAD_CANRUN(curthread, curcpu));
+
+	return 0;
+}
+
+uint32_t
+thread_getaffinity(void)
+{
+	return curthread->t_affinity;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * The scheduler is a multi-level feedback queue. Each cpu's run
+ * queue is kept sorted by priority level (see thread_enqueue), so the
+ * highest-priority ready thread is always at the head, and threads
+ * at the same level take turns. A thread that uses up the quantum
+ * for its level (sched_quantum[]) is moved down a level, where the
+ * quantum is longer; a thread that sleeps before using its quantum up
+ * keeps its level. Thus interactive threads, which mostly sleep,
+ * stay near the top and get the cpu quickly when they wake, while
+ * cpu hogs sink to the bottom and run in longer slices when there's
+ * nothing more urgent to do.
+ *
+ * Quantum usage accumulates across sleeps, so a thread can't keep
+ * its level by sleeping just before its quantum runs out.
+ *
+ * To keep threads at the bottom from starving, and to let threads
+ * whose behavior changes move back up, schedule() periodically boosts
+ * everything back to the top level.
  */
 
+/*
+ * Priority boost. This is called periodically from hardclock(). It
+ * moves everything on the current CPU's run queue, and the current
+ * thread, back up to the top level. Sleeping threads are caught up
+ * when they next become runnable by comparing their t_epoch with
+ * sched_epoch.
+ */
 void
 schedule(void)
 {
+	struct thread *t;
+
+	if (curcpu->c_number == 0) {
+		sched_epoch++;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	THREADLIST_FORALL(t, curcpu->c_runqueue) {
+		t->t_priority = 0;
+		t->t_ticks = 0;
+		t->t_epoch = sched_epoch;
+	}
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = 0;
+		curthread->t_ticks = 0;
+		curthread->t_epoch = sched_epoch;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+/*
+ * Quantum accounting. This is called from hardclock() on every tick.
+ * Charge the tick to the current thread; if that uses up its quantum,
+ * demote it. Then yield if some thread on the run queue is at the
+ * same level or higher.
+ */
+void
+thread_timeslice(void)
+{
+	struct thread *cur, *next;
+	bool expired, yield;
+
+	/* Nothing to do if we interrupted the idle loop. */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	cur = curthread;
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * A thread that isn't reading is a quiescent state too; this
+	 * keeps a cpu that never switches from holding up RCU.
 	 */
+	if (cur->t_rcu_nest == 0) {
+		rcu_quiescent();
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	cur->t_ticks++;
+	expired = cur->t_ticks >= sched_quantum[cur->t_priority];
+	if (expired) {
+		if (cur->t_priority < SCHED_NLEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_ticks = 0;
+	}
+
+	/*
+	 * With the quantum used up, take turns with others at our
+	 * level; otherwise only give way to a higher level.
+	 */
+	next = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+	if (next == NULL) {
+		yield = false;
+	}
+	else if (expired) {
+		yield = thread_level(next) <= thread_level(cur);
+	}
+	else {
+		yield = thread_level(next) < thread_level(cur);
+	}
+
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	/* An RCU reader can't be switched out; it yields on a later tick. */
+	if (yield && cur->t_rcu_nest == 0) {
+		thread_yield();
+	}
 }
 
+////////////////////////////////////////////////////////////
+
+#if OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK
+
 /*
- * Thread migration.
+ * Priority inheritance.
  *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * A thread that has to wait for a lock lends its level to the owner,
+ * and if the owner is itself waiting for another lock, to that lock's
+ * owner, and so on down the chain; otherwise a demoted lock holder
+ * can be kept off the cpu indefinitely by busy threads in between
+ * while a high-priority thread waits on it. When the owner releases
+ * a lock it drops back to the best level among the waiters of the
+ * locks it still holds, or to its own if there are none.
  *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
+ * A thread's held list only has the locks it holds that someone has
+ * waited for, so uncontended locking never has to touch it.
  *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * The waiter lists, the held lists and t_inherited are protected by
+ * pi_lock, which nests inside lock spinlocks and outside run queue
+ * locks. A thread deeper in a chain may keep a stale lent level for
+ * a while if a waiter gives up in between; that costs some fairness
+ * but no correctness, and it is fixed the next time it releases a
+ * lock.
  */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Set the level lent to T, moving it up its run queue if it's
+ * sitting on one.
+ */
+static
 void
-thread_consider_migration(void)
+thread_pi_lend(struct thread *t, unsigned level)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
 	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	struct thread *other;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+
+	t->t_inherited = level;
+
+	/*
+	 * T can be migrated while we're looking for it; it is on no
+	 * run queue while that happens, and it will be enqueued at
+	 * its new level afterwards.
+	 */
+	while (1) {
+		c = t->t_cpu;
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+		if (c == t->t_cpu) {
+			break;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
+	THREADLIST_FORALL(other, c->c_runqueue) {
+		if (other == t) {
+			threadlist_remove(&c->c_runqueue, t);
+			thread_enqueue(c, t);
+			break;
+		}
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Best level among the threads waiting for LK.
+ */
+static
+unsigned
+thread_pi_waiters(struct lock *lk)
+{
+	struct thread *t;
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+
+	level = SCHED_NLEVELS;
+	for (t = lk->lk_waiters; t != NULL; t = t->t_nextwaiter) {
+		if (thread_level(t) < level) {
+			level = thread_level(t);
+		}
+	}
+	return level;
+}
+
+/*
+ * Put LK on T's held list if it isn't there yet.
+ */
+static
+void
+thread_pi_hold(struct thread *t, struct lock *lk)
+{
+	struct lock *held;
+
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+
+	for (held = t->t_heldlocks; held != NULL; held = held->lk_nextheld) {
+		if (held == lk) {
+			return;
+		}
+	}
+	lk->lk_nextheld = t->t_heldlocks;
+	t->t_heldlocks = lk;
+}
+
+/*
+ * The current thread is about to wait for LK. Called with LK's
+ * spinlock held, and LK marked contended, so the owner can't let go
+ * and go away under us.
+ */
+void
+thread_pi_block(struct lock *lk)
+{
+	struct thread *owner;
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&lk->spinlock));
+	KASSERT(curthread->t_waitlock == NULL);
+
+	spinlock_acquire(&pi_lock);
+	curthread->t_waitlock = lk;
+	curthread->t_nextwaiter = lk->lk_waiters;
+	lk->lk_waiters = curthread;
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
+	owner = LOCK_OWNER(lk);
+	if (owner != NULL) {
+		thread_pi_hold(owner, lk);
+	}
+
+	level = thread_level(curthread);
+	while (lk != NULL && (owner = LOCK_OWNER(lk)) != NULL &&
+	       thread_level(owner) > level) {
+		thread_pi_lend(owner, level);
+		lk = owner->t_waitlock;
+	}
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * The current thread has stopped waiting for LK.
+ */
+void
+thread_pi_unblock(struct lock *lk)
+{
+	struct thread **tp;
+
+	spinlock_acquire(&pi_lock);
+	KASSERT(curthread->t_waitlock == lk);
+	for (tp = &lk->lk_waiters; *tp != curthread; tp = &(*tp)->t_nextwaiter) {
+		KASSERT(*tp != NULL);
+	}
+	*tp = curthread->t_nextwaiter;
+	curthread->t_nextwaiter = NULL;
+	curthread->t_waitlock = NULL;
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * The current thread has acquired LK. Anyone still waiting for it
+ * now waits for us.
+ */
+void
+thread_pi_acquired(struct lock *lk)
+{
+	unsigned level;
+
+	if (lk->lk_waiters == NULL) {
+		/* Stable: waiters come and go under LK's spinlock. */
 		return;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	spinlock_acquire(&pi_lock);
+	thread_pi_hold(curthread, lk);
+
+	level = thread_pi_waiters(lk);
+	if (level < curthread->t_inherited) {
+		curthread->t_inherited = level;
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
+	spinlock_release(&pi_lock);
+}
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+/*
+ * The current thread has released LK. Recompute what it inherits
+ * from the locks it still holds.
+ */
+void
+thread_pi_released(struct lock *lk)
+{
+	struct lock **lp, *held;
+	unsigned level, best;
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
+	spinlock_acquire(&pi_lock);
+	for (lp = &curthread->t_heldlocks; *lp != NULL && *lp != lk;
+	     lp = &(*lp)->lk_nextheld) {
+		/* nothing */
+	}
+	if (*lp == lk) {
+		*lp = lk->lk_nextheld;
+		lk->lk_nextheld = NULL;
+	}
+
+	if (curthread->t_inherited != SCHED_NLEVELS) {
+		best = SCHED_NLEVELS;
+		for (held = curthread->t_heldlocks; held != NULL;
+		     held = held->lk_nextheld) {
+			level = thread_pi_waiters(held);
+			if (level < best) {
+				best = level;
 			}
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		curthread->t_inherited = best;
 	}
+	spinlock_release(&pi_lock);
+}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+#endif /* OPT_LOCK_WITH_SEMAPHORES || OPT_LOCK_WCHAN_SPINLOCK */
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Wait channel functions
+ */
+
+#if OPT_HASHED_WCHAN
+
+/*
+ * Hashed sleep queues. Threads sleeping on any wchan go on the list
+ * in the bucket its address hashes to, marked with the wchan in
+ * t_wchan. Each bucket has its own spinlock, which protects only the
+ * list: the wchan's associated spinlock is still what makes sleeping
+ * and waking atomic with respect to the caller's condition.
+ *
+ * Bucket locks are leaves. thread_switch takes one while holding its
+ * run queue lock, so nothing (in particular thread_make_runnable) may
+ * be called with a bucket lock held.
+ */
+#define WCHAN_NBUCKETS 64
+
+struct wchan_bucket {
+	struct spinlock wb_lock;
+	struct threadlist wb_threads;
+};
+
+static struct wchan_bucket wchan_table[WCHAN_NBUCKETS];
+
+static
+void
+wchan_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<WCHAN_NBUCKETS; i++) {
+		spinlock_init(&wchan_table[i].wb_lock);
+		threadlist_init(&wchan_table[i].wb_threads);
+	}
+}
+
+static
+struct wchan_bucket *
+wchan_bucket(struct wchan *wc)
+{
+	uint32_t h;
+
+	h = (uint32_t)(uintptr_t)wc;
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return &wchan_table[h % WCHAN_NBUCKETS];
+}
+
+/*
+ * Put T to sleep on WC.
+ */
+static
+void
+wchan_enqueue(struct wchan *wc, struct thread *t)
+{
+	struct wchan_bucket *wb = wchan_bucket(wc);
+
+	spinlock_acquire(&wb->wb_lock);
+	t->t_wchan = wc;
+	threadlist_addtail(&wb->wb_threads, t);
+	spinlock_release(&wb->wb_lock);
+}
+
+/*
+ * Take thread T, or the first thread if T is NULL, off WC. Returns
+ * the thread, or NULL if it wasn't sleeping there.
+ */
+static
+struct thread *
+wchan_dequeue(struct wchan *wc, struct thread *t)
+{
+	struct wchan_bucket *wb = wchan_bucket(wc);
+	struct thread *target;
+
+	spinlock_acquire(&wb->wb_lock);
+	THREADLIST_FORALL(target, wb->wb_threads) {
+		if (target->t_wchan == wc && (t == NULL || target == t)) {
+			threadlist_remove(&wb->wb_threads, target);
+			target->t_wchan = NULL;
+			break;
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
 	}
+	spinlock_release(&wb->wb_lock);
+	return target;
+}
+
+/*
+ * Check if anyone is sleeping on WC.
+ */
+static
+bool
+wchan_empty(struct wchan *wc)
+{
+	struct wchan_bucket *wb = wchan_bucket(wc);
+	struct thread *t;
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	spinlock_acquire(&wb->wb_lock);
+	THREADLIST_FORALL(t, wb->wb_threads) {
+		if (t->t_wchan == wc) {
+			break;
+		}
+	}
+	spinlock_release(&wb->wb_lock);
+	return t == NULL;
 }
 
-////////////////////////////////////////////////////////////
+/*
+ * Initialize an embedded wait channel. There's nothing to it but the
+ * name.
+ */
+void
+wchan_init(struct wchan *wc, const char *name)
+{
+	wc->wc_name = name;
+}
 
 /*
- * Wait channel functions
+ * Clean up an embedded wait channel. Must be empty and unlocked.
  */
+void
+wchan_cleanup(struct wchan *wc)
+{
+	KASSERT(wchan_empty(wc));
+}
+
+/*
+ * Create a wait channel. NAME is a symbolic string name for it.
+ * This is what's displayed by ps -alx in Unix.
+ *
+ * NAME should generally be a string constant. If it isn't, alternate
+ * arrangements should be made to free it after the wait channel is
+ * destroyed.
+ */
+struct wchan *
+wchan_create(const char *name)
+{
+	struct wchan *wc;
+
+	wc = kmalloc(sizeof(*wc));
+	if (wc == NULL) {
+		return NULL;
+	}
+	wchan_init(wc, name);
+
+	return wc;
+}
+
+/*
+ * Destroy a wait channel. Must be empty and unlocked.
+ */
+void
+wchan_destroy(struct wchan *wc)
+{
+	wchan_cleanup(wc);
+	kfree(wc);
+}
+
+#else /* !OPT_HASHED_WCHAN */
+
+static
+void
+wchan_enqueue(struct wchan *wc, struct thread *t)
+{
+	threadlist_addtail(&wc->wc_threads, t);
+}
+
+static
+struct thread *
+wchan_dequeue(struct wchan *wc, struct thread *t)
+{
+	struct thread *target;
+
+	if (t == NULL) {
+		return threadlist_remhead(&wc->wc_threads);
+	}
+	THREADLIST_FORALL(target, wc->wc_threads) {
+		if (target == t) {
+			threadlist_remove(&wc->wc_threads, target);
+			break;
+		}
+	}
+	return target;
+}
+
+static
+bool
+wchan_empty(struct wchan *wc)
+{
+	return threadlist_isempty(&wc->wc_threads);
+}
 
 /*
  * Create a wait channel. NAME is a symbolic string name for it.
@@ -994,6 +1955,8 @@ wchan_destroy(struct wchan *wc)
 	kfree(wc);
 }
 
+#endif /* OPT_HASHED_WCHAN */
+
 /*
  * Yield the cpu to another process, and go to sleep, on the specified
  * wait channel WC, whose associated spinlock is LK. Calling wakeup on
@@ -1017,6 +1980,63 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(lk);
 }
 
+/*
+ * Timeout for wchan_timedsleep.
+ */
+struct wchan_timeout {
+	struct wchan *wt_wc;
+	struct spinlock *wt_lk;
+	struct thread *wt_thread;
+	bool wt_expired;
+};
+
+/*
+ * Timer function for wchan_timedsleep: wake the thread up, if it's
+ * still asleep on the channel.
+ */
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+
+	spinlock_acquire(wt->wt_lk);
+	if (wchan_dequeue(wt->wt_wc, wt->wt_thread) != NULL) {
+		thread_make_runnable(wt->wt_thread, false);
+		wt->wt_expired = true;
+	}
+	spinlock_release(wt->wt_lk);
+}
+
+/*
+ * Like wchan_sleep, but also wake up after TICKS hardclocks if nobody
+ * else has by then. Returns true if it was the timeout that woke us.
+ *
+ * LK is dropped briefly after waking up to stop the timer, since the
+ * timer function takes it.
+ */
+bool
+wchan_timedsleep(struct wchan *wc, struct spinlock *lk, unsigned ticks)
+{
+	struct wchan_timeout wt;
+	struct timer tm;
+
+	wt.wt_wc = wc;
+	wt.wt_lk = lk;
+	wt.wt_thread = curthread;
+	wt.wt_expired = false;
+
+	timer_init(&tm, wchan_timeout, &wt);
+	timer_start(&tm, ticks);
+	wchan_sleep(wc, lk);
+
+	spinlock_release(lk);
+	timer_stop(&tm);
+	spinlock_acquire(lk);
+
+	return wt.wt_expired;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1028,7 +2048,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	KASSERT(spinlock_do_i_hold(lk));
 
 	/* Grab a thread from the channel */
-	target = threadlist_remhead(&wc->wc_threads);
+	target = wchan_dequeue(wc, NULL);
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
@@ -1053,35 +2073,45 @@ void
 wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *target;
-	struct threadlist list;
 
 	KASSERT(spinlock_do_i_hold(lk));
 
-	threadlist_init(&list);
-
-	/*
-	 * Grab all the threads from the channel, moving them to a
-	 * private list.
-	 */
-	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
-		threadlist_addtail(&list, target);
-	}
-
 	/*
 	 * We could conceivably sort by cpu first to cause fewer lock
 	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
+	 * make each thread runnable as it comes off the channel. (LK
+	 * keeps anyone else from touching the channel meanwhile.)
 	 */
-	while ((target = threadlist_remhead(&list)) != NULL) {
+	while ((target = wchan_dequeue(wc, NULL)) != NULL) {
 		thread_make_runnable(target, false);
 	}
+}
 
-	threadlist_cleanup(&list);
+/*
+ * Move sleeping threads from one wait channel to another.
+ */
+void
+wchan_transfer(struct wchan *from, struct spinlock *fromlk,
+	       struct wchan *to, struct spinlock *tolk, bool all)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	while ((target = wchan_dequeue(from, NULL)) != NULL) {
+		target->t_wchan_name = to->wc_name;
+		wchan_enqueue(to, target);
+		if (!all) {
+			break;
+		}
+	}
 }
 
 /*
  * Return nonzero if there are no threads sleeping on the channel.
- * This is meant to be used only for diagnostic purposes.
+ * The associated spinlock must be locked, and the answer is only
+ * good for as long as it stays locked.
  */
 bool
 wchan_isempty(struct wchan *wc, struct spinlock *lk)
@@ -1089,7 +2119,7 @@ wchan_isempty(struct wchan *wc, struct spinlock *lk)
 	bool ret;
 
 	KASSERT(spinlock_do_i_hold(lk));
-	ret = threadlist_isempty(&wc->wc_threads);
+	ret = wchan_empty(wc);
 
 	return ret;
 }
@@ -0,0 +1,152 @@
+/*
+ * Deferred work queues. See workqueue.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <workqueue.h>
+
+/* Number of worker threads per cpu. */
+#define WORKQUEUE_NTHREADS 2
+
+/*
+ * Per-cpu queue. The lock also protects the wchan the workers sleep
+ * on when the queue is empty.
+ */
+struct workqueue {
+	struct spinlock wq_lock;
+	struct wchan *wq_wchan;
+	struct work *wq_head;
+	struct work *wq_tail;
+};
+
+/*
+ * Worker thread. Pin ourselves to the queue's cpu, then run work
+ * items forever.
+ */
+static
+void
+workqueue_thread(void *data1, unsigned long cpunum)
+{
+	struct workqueue *wq = data1;
+	struct work *wk;
+	int result;
+
+	result = thread_setaffinity((uint32_t)1 << cpunum);
+	KASSERT(result == 0);
+
+	spinlock_acquire(&wq->wq_lock);
+	while (1) {
+		wk = wq->wq_head;
+		if (wk == NULL) {
+			wchan_sleep(wq->wq_wchan, &wq->wq_lock);
+			continue;
+		}
+		wq->wq_head = wk->wk_next;
+		if (wq->wq_head == NULL) {
+			wq->wq_tail = NULL;
+		}
+		wk->wk_next = NULL;
+		spinlock_release(&wq->wq_lock);
+
+		/* Let it be queued again, on any cpu. */
+		membar_any_store();
+		spinlock_data_set(&wk->wk_queued, 0);
+
+		/* WK may be freed or requeued from here on. */
+		wk->wk_func(wk->wk_data);
+
+		spinlock_acquire(&wq->wq_lock);
+	}
+}
+
+/*
+ * Set up a queue and its workers for each cpu.
+ */
+void
+workqueue_bootstrap(void)
+{
+	struct workqueue *wq;
+	struct cpu *c;
+	char name[16];
+	unsigned i, j;
+	int result;
+
+	for (i=0; (c = cpu_lookup(i)) != NULL; i++) {
+		wq = kmalloc(sizeof(*wq));
+		if (wq == NULL) {
+			panic("workqueue_bootstrap: Out of memory\n");
+		}
+		spinlock_init(&wq->wq_lock);
+		wq->wq_wchan = wchan_create("workqueue");
+		if (wq->wq_wchan == NULL) {
+			panic("workqueue_bootstrap: wchan_create failed\n");
+		}
+		wq->wq_head = NULL;
+		wq->wq_tail = NULL;
+		c->c_workqueue = wq;
+
+		for (j=0; j<WORKQUEUE_NTHREADS; j++) {
+			snprintf(name, sizeof(name), "work/%u.%u", i, j);
+			result = thread_fork(name, kproc, workqueue_thread,
+					     wq, i);
+			if (result) {
+				panic("workqueue_bootstrap: thread_fork: %s\n",
+				      strerror(result));
+			}
+		}
+	}
+}
+
+void
+work_init(struct work *wk, void (*func)(void *), void *data)
+{
+	wk->wk_next = NULL;
+	spinlock_data_set(&wk->wk_queued, 0);
+	wk->wk_func = func;
+	wk->wk_data = data;
+}
+
+bool
+work_queue(struct work *wk)
+{
+	struct workqueue *wq;
+	int spl;
+
+	/*
+	 * Claim the item before picking a queue; the queue locks are
+	 * per cpu and don't keep another cpu from queueing it too.
+	 */
+	if (spinlock_data_testandset(&wk->wk_queued) != 0) {
+		return false;
+	}
+	membar_any_any();
+
+	/* Stay on this cpu while picking its queue. */
+	spl = splhigh();
+	wq = curcpu->c_workqueue;
+	KASSERT(wq != NULL);
+
+	spinlock_acquire(&wq->wq_lock);
+	wk->wk_next = NULL;
+	if (wq->wq_tail == NULL) {
+		wq->wq_head = wk;
+	}
+	else {
+		wq->wq_tail->wk_next = wk;
+	}
+	wq->wq_tail = wk;
+	wchan_wakeone(wq->wq_wchan, &wq->wq_lock);
+	spinlock_release(&wq->wq_lock);
+	splx(spl);
+
+	return true;
+}
@@ -345,6 +345,19 @@ freepageref(struct pageref *p)
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
 
+/*
+ * Pagerefs for multi-page spans handed out by large_kmalloc are kept
+ * separately: largebase lists the spans in use, and largefree[n-1]
+ * caches freed spans of n pages for reuse. These use next_samesize
+ * only; the page count is kept in nfree.
+ */
+#define LARGE_MAXPAGES 4	/* largest span size we cache */
+#define LARGE_MAXCACHED 8	/* max cached spans of each size */
+
+static struct pageref *largebase;
+static struct pageref *largefree[LARGE_MAXPAGES];
+static unsigned largenfree[LARGE_MAXPAGES];
+
 ////////////////////////////////////////
 
 #ifdef GUARDS
@@ -801,6 +814,7 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	unsigned i, n;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -811,6 +825,17 @@ kheap_printstats(void)
 		subpage_stats(pr);
 	}
 
+	kprintf("Large allocator status:\n");
+	n = 0;
+	for (pr = largebase; pr != NULL; pr = pr->next_samesize) {
+		n += pr->nfree;
+	}
+	kprintf("   %u pages in use\n", n);
+	for (i=0; i<LARGE_MAXPAGES; i++) {
+		kprintf("   %u-page spans cached: %u/%u\n",
+			i+1, largenfree[i], LARGE_MAXCACHED);
+	}
+
 	spinlock_release(&kmalloc_spinlock);
 }
 
@@ -1159,6 +1184,423 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+//
+////////////////////////////////////////////////////////////
+//
+// Large-object allocator.
+//
+// Allocations too big for the subpage allocator are made in whole
+// pages. Each span handed out is tracked by a pageref on largebase so
+// that kfree can find out how big it is. Freed spans of up to
+// LARGE_MAXPAGES pages are not returned to free_kpages but cached on
+// largefree[] by size, so the next allocation of the same size (most
+// commonly a thread stack) doesn't have to go to the page allocator.
+//
+// Cached spans are not deadbeefed: doing so would cost about as much
+// as the round trip through the page allocator we're trying to save.
+//
+
+/*
+ * Allocate a span of NPAGES pages.
+ */
+static
+void *
+large_kmalloc(unsigned long npages)
+{
+	struct pageref *pr;
+	vaddr_t address;
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	if (npages <= LARGE_MAXPAGES && largefree[npages-1] != NULL) {
+		/* Reuse a cached span. */
+		pr = largefree[npages-1];
+		largefree[npages-1] = pr->next_samesize;
+		KASSERT(largenfree[npages-1] > 0);
+		largenfree[npages-1]--;
+		KASSERT(pr->nfree == npages);
+
+		pr->next_samesize = largebase;
+		largebase = pr;
+
+		spinlock_release(&kmalloc_spinlock);
+		return (void *)PR_PAGEADDR(pr);
+	}
+
+	spinlock_release(&kmalloc_spinlock);
+
+	/* Call alloc_kpages without kmalloc_spinlock. */
+	address = alloc_kpages(npages);
+	if (address==0) {
+		return NULL;
+	}
+	KASSERT(address % PAGE_SIZE == 0);
+
+	spinlock_acquire(&kmalloc_spinlock);
+	pr = allocpageref();
+	if (pr == NULL) {
+		/*
+		 * No accounting space. Hand out the span anyway;
+		 * large_kfree won't recognize it and kfree will pass
+		 * it straight to free_kpages.
+		 */
+		spinlock_release(&kmalloc_spinlock);
+		return (void *)address;
+	}
+	pr->pageaddr_and_blocktype = MKPAB(address, 0);
+	pr->freelist_offset = INVALID_OFFSET;
+	pr->nfree = npages;
+	pr->next_all = NULL;
+	pr->next_samesize = largebase;
+	largebase = pr;
+	spinlock_release(&kmalloc_spinlock);
+
+	return (void *)address;
+}
+
+/*
+ * Free a span previously returned from large_kmalloc. If the pointer
+ * is not a span we know about, return -1.
+ */
+static
+int
+large_kfree(void *ptr)
+{
+	struct pageref **guy, *pr;
+	vaddr_t ptraddr;
+	unsigned npages;
+
+	ptraddr = (vaddr_t)ptr;
+	if (ptraddr % PAGE_SIZE != 0) {
+		return -1;
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	for (guy = &largebase; *guy; guy = &(*guy)->next_samesize) {
+		if (PR_PAGEADDR(*guy) == ptraddr) {
+			break;
+		}
+	}
+	pr = *guy;
+	if (pr == NULL) {
+		spinlock_release(&kmalloc_spinlock);
+		return -1;
+	}
+	*guy = pr->next_samesize;
+
+	npages = pr->nfree;
+	if (npages <= LARGE_MAXPAGES && largenfree[npages-1] < LARGE_MAXCACHED) {
+		/* Keep it for next time. */
+		pr->next_samesize = largefree[npages-1];
+		largefree[npages-1] = pr;
+		largenfree[npages-1]++;
+		spinlock_release(&kmalloc_spinlock);
+		return 0;
+	}
+
+	freepageref(pr);
+	/* Call free_kpages without kmalloc_spinlock. */
+	spinlock_release(&kmalloc_spinlock);
+	free_kpages(ptraddr);
+
+	return 0;
+}
+
+//
+////////////////////////////////////////////////////////////
+//
+// Allocation-site profiling.
+//
+// This is the always-available cousin of LABELS: rather than tagging
+// every block with a header (which changes the heap layout and has
+// to be compiled in), we sample one allocation out of every
+// kheap_profrate and charge it to its call site and size class in a
+// fixed-size table. The sampled pointers are remembered so that the
+// matching kfree can be charged back to the same site, which gives
+// an estimate of how much of the live heap each site is holding.
+//
+// None of the tables here may use kmalloc, for obvious reasons, so
+// they are statically sized. Samples that don't fit are counted as
+// dropped rather than being recorded.
+//
+// When profiling is off the cost is one load and branch in kmalloc
+// and one in kfree.
+//
+
+/* Number of distinct (site, size class) pairs we can track. */
+#define PROF_NSITES 128
+/* Number of sampled blocks we can remember at once. */
+#define PROF_NLIVE 512
+/* Size class used for whole-page allocations. */
+#define PROF_LARGE NSIZES
+
+struct profsite {
+	vaddr_t ps_site;		/* return address of kmalloc call */
+	unsigned ps_sizeclass;		/* index into sizes[], or PROF_LARGE */
+	unsigned ps_allocs;		/* number of sampled allocations */
+	unsigned ps_frees;		/* number of sampled frees */
+	size_t ps_bytes;		/* bytes requested by sampled allocs */
+	size_t ps_livebytes;		/* sampled bytes not yet freed */
+};
+
+struct proflive {
+	vaddr_t pl_ptr;			/* sampled block, or 0 if unused */
+	size_t pl_size;			/* size requested */
+	struct profsite *pl_site;	/* site to charge the free to */
+};
+
+static struct spinlock kheap_prof_spinlock = SPINLOCK_INITIALIZER;
+
+/* 0 means profiling is off; otherwise sample one in this many. */
+static volatile unsigned kheap_profrate;
+/* Allocation counter for sampling; races are harmless. */
+static volatile unsigned kheap_profcount;
+/* Number of entries in use in kheap_proflive[]. */
+static volatile unsigned kheap_proflivecount;
+/* Number of samples we had no room to record. */
+static unsigned kheap_profdropped;
+
+static struct profsite kheap_profsites[PROF_NSITES];
+static struct proflive kheap_proflive[PROF_NLIVE];
+
+/*
+ * Hash a pointer-sized value. Heap blocks and return addresses are
+ * both at least word-aligned, so shift away the low bits first.
+ */
+static
+inline
+unsigned
+prof_hash(vaddr_t val)
+{
+	return (val >> 2) * 2654435761U;
+}
+
+/*
+ * Record a sampled allocation of SZ bytes at PTR, made from SITE.
+ */
+static
+void
+prof_alloc(void *ptr, size_t sz, vaddr_t site)
+{
+	unsigned sizeclass, h, i;
+	struct profsite *ps;
+	struct proflive *pl;
+
+	if (sz + GUARD_OVERHEAD + LABEL_OVERHEAD >= LARGEST_SUBPAGE_SIZE) {
+		sizeclass = PROF_LARGE;
+	}
+	else {
+		sizeclass = blocktype(sz + GUARD_OVERHEAD + LABEL_OVERHEAD);
+	}
+
+	spinlock_acquire(&kheap_prof_spinlock);
+
+	/* Find or claim the site entry (open addressing, linear probe). */
+	h = prof_hash(site) + sizeclass;
+	ps = NULL;
+	for (i=0; i<PROF_NSITES; i++) {
+		ps = &kheap_profsites[(h + i) % PROF_NSITES];
+		if (ps->ps_site == site && ps->ps_sizeclass == sizeclass) {
+			break;
+		}
+		if (ps->ps_site == 0) {
+			ps->ps_site = site;
+			ps->ps_sizeclass = sizeclass;
+			break;
+		}
+	}
+	if (i == PROF_NSITES) {
+		kheap_profdropped++;
+		spinlock_release(&kheap_prof_spinlock);
+		return;
+	}
+
+	/* Remember the block so its kfree can be matched up. */
+	h = prof_hash((vaddr_t)ptr);
+	for (i=0; i<PROF_NLIVE; i++) {
+		pl = &kheap_proflive[(h + i) % PROF_NLIVE];
+		if (pl->pl_ptr == 0) {
+			pl->pl_ptr = (vaddr_t)ptr;
+			pl->pl_size = sz;
+			pl->pl_site = ps;
+			kheap_proflivecount++;
+			ps->ps_livebytes += sz;
+			break;
+		}
+	}
+	if (i == PROF_NLIVE) {
+		kheap_profdropped++;
+	}
+
+	ps->ps_allocs++;
+	ps->ps_bytes += sz;
+
+	spinlock_release(&kheap_prof_spinlock);
+}
+
+/*
+ * Note that PTR is being freed; if it was sampled, charge the free to
+ * the site that allocated it.
+ */
+static
+void
+prof_free(void *ptr)
+{
+	unsigned h, i;
+	struct proflive *pl;
+
+	h = prof_hash((vaddr_t)ptr);
+
+	spinlock_acquire(&kheap_prof_spinlock);
+	for (i=0; i<PROF_NLIVE; i++) {
+		pl = &kheap_proflive[(h + i) % PROF_NLIVE];
+		if (pl->pl_ptr == (vaddr_t)ptr) {
+			break;
+		}
+		/*
+		 * Entries are never removed from the middle of a probe
+		 * chain without rehashing (see below), so an empty slot
+		 * means the pointer isn't here.
+		 */
+		if (pl->pl_ptr == 0) {
+			spinlock_release(&kheap_prof_spinlock);
+			return;
+		}
+	}
+	if (i == PROF_NLIVE) {
+		spinlock_release(&kheap_prof_spinlock);
+		return;
+	}
+
+	KASSERT(pl->pl_site->ps_livebytes >= pl->pl_size);
+	pl->pl_site->ps_livebytes -= pl->pl_size;
+	pl->pl_site->ps_frees++;
+	pl->pl_ptr = 0;
+	KASSERT(kheap_proflivecount > 0);
+	kheap_proflivecount--;
+
+	/* Reinsert the rest of the probe chain so lookups stay correct. */
+	for (i = (h + i + 1) % PROF_NLIVE;
+	     kheap_proflive[i].pl_ptr != 0;
+	     i = (i + 1) % PROF_NLIVE) {
+		struct proflive tmp;
+		unsigned j;
+
+		tmp = kheap_proflive[i];
+		kheap_proflive[i].pl_ptr = 0;
+		j = prof_hash(tmp.pl_ptr);
+		while (kheap_proflive[j % PROF_NLIVE].pl_ptr != 0) {
+			j++;
+		}
+		kheap_proflive[j % PROF_NLIVE] = tmp;
+	}
+
+	spinlock_release(&kheap_prof_spinlock);
+}
+
+/*
+ * Turn on sampling of one allocation in RATE. A rate of 1 records
+ * every allocation.
+ */
+void
+kheap_profile_start(unsigned rate)
+{
+	KASSERT(rate > 0);
+	kheap_profcount = 0;
+	kheap_profrate = rate;
+}
+
+/*
+ * Turn off sampling. Blocks already sampled are still matched up
+ * with their frees, so the live byte counts stay meaningful.
+ */
+void
+kheap_profile_stop(void)
+{
+	kheap_profrate = 0;
+}
+
+/*
+ * Discard all collected samples.
+ */
+void
+kheap_profile_reset(void)
+{
+	unsigned i;
+
+	spinlock_acquire(&kheap_prof_spinlock);
+	for (i=0; i<PROF_NSITES; i++) {
+		bzero(&kheap_profsites[i], sizeof(kheap_profsites[i]));
+	}
+	for (i=0; i<PROF_NLIVE; i++) {
+		bzero(&kheap_proflive[i], sizeof(kheap_proflive[i]));
+	}
+	kheap_proflivecount = 0;
+	kheap_profdropped = 0;
+	spinlock_release(&kheap_prof_spinlock);
+}
+
+/*
+ * Print the profile, sites holding the most live memory first.
+ */
+void
+kheap_profile_dump(void)
+{
+	uint32_t done[PROF_NSITES / 32];
+	struct profsite *ps, *best;
+	unsigned i, n, rate;
+
+	rate = kheap_profrate;
+
+	for (i=0; i<ARRAYCOUNT(done); i++) {
+		done[i] = 0;
+	}
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kheap_prof_spinlock);
+
+	kprintf("Kernel heap profile (%s, 1 in %u sampled, %u dropped):\n",
+		rate ? "running" : "stopped", rate, kheap_profdropped);
+	kprintf("  %-10s %5s %8s %8s %10s %10s\n",
+		"site", "size", "allocs", "frees", "bytes", "live");
+
+	for (n=0; n<PROF_NSITES; n++) {
+		best = NULL;
+		for (i=0; i<PROF_NSITES; i++) {
+			ps = &kheap_profsites[i];
+			if (ps->ps_site == 0 || (done[i/32] & (1U << (i%32)))) {
+				continue;
+			}
+			if (best == NULL || ps->ps_livebytes > best->ps_livebytes
+			    || (ps->ps_livebytes == best->ps_livebytes
+				&& ps->ps_bytes > best->ps_bytes)) {
+				best = ps;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		i = best - kheap_profsites;
+		done[i/32] |= 1U << (i%32);
+
+		if (best->ps_sizeclass == PROF_LARGE) {
+			kprintf("  0x%08lx %5s", (unsigned long)best->ps_site,
+				"pages");
+		}
+		else {
+			kprintf("  0x%08lx %5lu", (unsigned long)best->ps_site,
+				(unsigned long)sizes[best->ps_sizeclass]);
+		}
+		kprintf(" %8u %8u %10lu %10lu\n",
+			best->ps_allocs, best->ps_frees,
+			(unsigned long)best->ps_bytes,
+			(unsigned long)best->ps_livebytes);
+	}
+
+	spinlock_release(&kheap_prof_spinlock);
+}
+
 //
 ////////////////////////////////////////////////////////////
 
@@ -1170,6 +1612,7 @@ void *
 kmalloc(size_t sz)
 {
 	size_t checksz;
+	void *ptr;
 #ifdef LABELS
 	vaddr_t label;
 #endif
@@ -1185,24 +1628,28 @@ kmalloc(size_t sz)
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
-		vaddr_t address;
 
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
-		if (address==0) {
+		ptr = large_kmalloc(npages);
+		if (ptr == NULL) {
 			return NULL;
 		}
-		KASSERT(address % PAGE_SIZE == 0);
-
-		return (void *)address;
 	}
-
+	else {
 #ifdef LABELS
-	return subpage_kmalloc(sz, label);
+		ptr = subpage_kmalloc(sz, label);
 #else
-	return subpage_kmalloc(sz);
+		ptr = subpage_kmalloc(sz);
 #endif
+	}
+
+	if (kheap_profrate != 0 && ptr != NULL &&
+	    ++kheap_profcount % kheap_profrate == 0) {
+		prof_alloc(ptr, sz, (vaddr_t)__builtin_return_address(0));
+	}
+
+	return ptr;
 }
 
 /*
@@ -1212,11 +1659,16 @@ void
 kfree(void *ptr)
 {
 	/*
-	 * Try subpage first; if that fails, assume it's a big allocation.
+	 * Try subpage first, then the large allocator; if both fail,
+	 * assume it's a big allocation we weren't able to track.
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+	if (kheap_proflivecount != 0) {
+		prof_free(ptr);
+	}
+	if (subpage_kfree(ptr) && large_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
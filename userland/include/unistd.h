@@ -147,7 +147,12 @@ ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
+int sched_setaffinity(unsigned mask);
+int sched_getaffinity(unsigned *mask);
+int futex_wait(volatile int *addr, int val);
+int futex_wake(volatile int *addr, int n);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -0,0 +1,50 @@
+/*
+ * futextest - check the error and no-waiter cases of futex_wait and
+ * futex_wake.
+ *
+ * None of these ever sleeps, so the test runs the same on one cpu as
+ * on many.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+static volatile int words[2];
+
+int
+main(void)
+{
+	volatile int *misaligned;
+	int r;
+
+	/* The word doesn't hold the value we expect: don't sleep. */
+	words[0] = 1;
+	r = futex_wait(&words[0], 0);
+	if (r != -1 || errno != EAGAIN) {
+		errx(1, "futex_wait on a mismatch: got %d (errno %d), "
+		     "expected EAGAIN", r, errno);
+	}
+
+	misaligned = (volatile int *)((volatile char *)&words[0] + 1);
+	r = futex_wait(misaligned, 0);
+	if (r != -1 || errno != EINVAL) {
+		errx(1, "futex_wait on a misaligned address: got %d "
+		     "(errno %d), expected EINVAL", r, errno);
+	}
+	r = futex_wake(misaligned, 1);
+	if (r != -1 || errno != EINVAL) {
+		errx(1, "futex_wake on a misaligned address: got %d "
+		     "(errno %d), expected EINVAL", r, errno);
+	}
+
+	/* Nobody is waiting, so nobody gets woken. */
+	r = futex_wake(&words[1], 1);
+	if (r != 0) {
+		errx(1, "futex_wake with no waiters returned %d", r);
+	}
+
+	printf("futextest: passed\n");
+	return 0;
+}